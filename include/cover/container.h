@@ -3,8 +3,14 @@
 
 	The #Cover_container_read function reads DCT coefficients and other properties of an image. The coefficients can be examined and modified by the caller or by other library functions and then written into an image with #Cover_container_write. This function recreates the original image, but with new coefficient values.
 
+	#Cover_container_read_buffer and #Cover_container_write_buffer do the same with images in memory. #Cover_container_write_fast is a faster alternative to #Cover_container_write, which keeps the Huffman tables of the original image. #Cover_container_write_spliced goes further and re-encodes only the changed restart intervals of the original image.
+
+	#Cover_container_export_plane gives all coefficients of the first component as one array, and #Cover_container_import_plane writes them back.
+
 	Only the first colour component of a JPEG image is used, other are copied unchanged.
 
+	The library has no global state. Its functions can be called concurrently from different threads, as long as they work on different structures, for example two images can be read in parallel. LibJPEG gives the same guarantee for different compressor and decompressor structures.
+
 	The header file contains an include guard.
 */
 
@@ -16,6 +22,7 @@
 	#define COVER_CONTAINER_H
 
 	#include <stddef.h>
+	#include <stdint.h>
 	#include <stdbool.h>
 	#include <stdio.h>
 
@@ -73,6 +80,12 @@
 		*/
 
 		struct jvirt_barray_control **coefficients_arrays;
+
+		/**
+			Bit array of changed rows of blocks, or `NULL` if changes aren't tracked. See #Cover_container_track_changes.
+		*/
+
+		uint8_t *changed_rows;
 	};
 
 	/**
@@ -93,6 +106,189 @@
 
 	bool Cover_container_read(struct Cover_container *context, struct jpeg_decompress_struct *decompressor);
 
+	/**
+		Initializes a #Cover_container structure from an image in memory.
+
+		\param [out] context The structure to initialize.
+
+		\param decompressor An initialized LibJPEG decompressor structure without an image source. It must remain untouched by the caller for the lifetime of the context.
+
+		\param length The length of the image.
+
+		\param data The image. It's read without copying, so it must remain untouched by the caller for the lifetime of the context.
+
+		\returns `true` on success or `false` if the image is incompatible or too long for LibJPEG.
+
+		Works as #Cover_container_read with the LibJPEG memory source.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function.
+
+		\see The header file description.
+	*/
+
+	bool Cover_container_read_buffer(
+		struct Cover_container *context,
+		struct jpeg_decompress_struct *decompressor,
+		size_t length,
+		const uint8_t *data
+	);
+
+	/**
+		Reads only the header of an image, the first step of #Cover_container_read.
+
+		\param [out] context The structure to initialize. Its fields, except the coefficient arrays, are set.
+
+		\param decompressor An initialized LibJPEG decompressor structure with a set image source. It must remain untouched by the caller for the lifetime of the context.
+
+		\returns `true` on success or `false` if the image is incompatible.
+
+		The coefficients should be then read with #Cover_container_read_coefficients or passed through #Cover_container_scan.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function.
+
+		\see The header file description.
+	*/
+
+	bool Cover_container_read_header(struct Cover_container *context, struct jpeg_decompress_struct *decompressor);
+
+	/**
+		Reads coefficients, the second step of #Cover_container_read.
+
+		\param context The structure, initialized by #Cover_container_read_header.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function.
+
+		\see The header file description.
+	*/
+
+	void Cover_container_read_coefficients(struct Cover_container *context);
+
+	/**
+		Decodes coefficients row by row, without keeping them.
+
+		\param context The structure, initialized by #Cover_container_read_header.
+
+		\param visit A callback, which receives the `argument`, an index of a block row of the first component and the row of #Cover_container.width_in_blocks blocks. The rows come in order. The blocks are valid only during the call.
+
+		\param argument An argument for the callback.
+
+		\returns `false` without reading anything for progressive images, because their scans revisit all rows. They should be read with #Cover_container_read_coefficients instead.
+
+		Only a window of one row of MCUs is allocated for each component, instead of whole-image arrays, which may need several bytes per coefficient or even temporary files. The coefficient arrays of the structure stay `NULL`, so it can't be used to write an image.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function, including the callback.
+
+		\see The header file description.
+	*/
+
+	bool Cover_container_scan(struct Cover_container *context, void (*visit)(void *argument, size_t y, JBLOCKROW row), void *argument);
+
+	/**
+		Coefficient plane structure.
+	*/
+
+	struct Cover_container_plane {
+		/**
+			All coefficients of the first component in one array. Blocks follow row by row, the block `x` of the row `y` starts at the index `COVER_CONTAINER_BLOCK_LENGTH * (width_in_blocks * y + x)`. Coefficients of a block are in the natural order.
+		*/
+
+		JCOEF *coefficients;
+
+		/**
+			`false` if the plane is the LibJPEG array itself, so changes of the plane are changes of the image, or `true` if it's a copy.
+		*/
+
+		bool copied;
+
+		/**
+			Private. The memory of a copy or `NULL`.
+		*/
+
+		void *buffer;
+	};
+
+	/**
+		Exports coefficients of the first component as a dense plane.
+
+		\param context The structure, initialized by #Cover_container_read.
+
+		\param [out] plane The plane structure to initialize.
+
+		\returns `true` on success or `false` on a memory allocation failure.
+
+		If LibJPEG keeps the whole array in memory in one chunk, the plane points to it without copying. Otherwise the coefficients are copied once.
+
+		The plane should be destroyed with #Cover_container_plane_destroy.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function, in this case #Cover_container_plane_destroy must be called explicitly to free allocated memory.
+
+		\see The header file description.
+	*/
+
+	bool Cover_container_export_plane(struct Cover_container *context, struct Cover_container_plane *plane);
+
+	/**
+		Writes a plane back to the coefficients of the first component.
+
+		\param context The structure, initialized by #Cover_container_read.
+
+		\param coefficients #Cover_container.coefficients_count coefficients in the layout of #Cover_container_plane.coefficients, for example, a modified plane.
+
+		Rows of a plane, which is not a copy, are skipped.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function.
+
+		\see The header file description.
+	*/
+
+	void Cover_container_import_plane(struct Cover_container *context, const JCOEF *coefficients);
+
+	/**
+		Destroys a plane structure.
+
+		\param plane The structure.
+	*/
+
+	void Cover_container_plane_destroy(struct Cover_container_plane *plane);
+
+	/**
+		Block row visitor structure for #Cover_container_visit.
+	*/
+
+	struct Cover_container_visitor {
+		/**
+			A callback, which receives the #argument, an index of a block row and the row of #Cover_container.width_in_blocks blocks. The blocks must not be modified.
+		*/
+
+		void (*visit)(void *argument, size_t y, JBLOCKROW row);
+
+		/**
+			An argument for the callback.
+		*/
+
+		void *argument;
+	};
+
+	/**
+		Passes coefficients of the first component to several visitors in one traversal.
+
+		\param context The structure, initialized by #Cover_container_read.
+
+		\param visitors An array of visitors.
+
+		\param visitors_count The length of the array.
+
+		If LibJPEG keeps the whole array in memory, rows are processed in batches, which fit in the cache: each visitor gets all rows of a batch in order, then the next visitor gets the same rows. Otherwise all visitors get a row before the next one is read. In both cases the visitors see each row in order, but their calls interleave.
+
+		Visitors can be prepared by #Cover_Eph5_initialize_deferred and #Cover_Rang_initialize_deferred, so that several contexts are initialized from one read of the coefficients.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function, including the callbacks.
+
+		\see The header file description.
+	*/
+
+	void Cover_container_visit(struct Cover_container *context, const struct Cover_container_visitor *visitors, size_t visitors_count);
+
 	/**
 		Creates a JPEG image from a #Cover_container structure.
 
@@ -106,4 +302,111 @@
 	*/
 
 	void Cover_container_write(struct Cover_container *context, struct jpeg_compress_struct *compressor);
+
+	/**
+		Creates a JPEG image from a #Cover_container structure with the Huffman tables of the original image.
+
+		\param context The structure, initialized by #Cover_container_read.
+
+		\param compressor An initialized LibJPEG compressor structure with a set image destination.
+
+		\returns `true` if the tables are reused, `false` if the image is written by #Cover_container_write.
+
+		#Cover_container_write optimizes the tables, so LibJPEG has to gather statistics before coding. The original tables are reused only if the image is sequential, has one scan and the tables have codes for all symbols of the modified coefficients. The restart interval of the original image is kept, because DC coefficients of other components are coded by the tables as differences, which restart at each interval. The image is usually a little bigger than with optimized tables.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function.
+
+		\see The header file description.
+	*/
+
+	bool Cover_container_write_fast(struct Cover_container *context, struct jpeg_compress_struct *compressor);
+
+	/**
+		Creates a JPEG image in memory from a #Cover_container structure.
+
+		\param context The structure, initialized by #Cover_container_read.
+
+		\param compressor An initialized LibJPEG compressor structure without an image destination.
+
+		\param [in,out] length The length of the `*data` buffer. Receives the length of the image.
+
+		\param [in,out] data A buffer, allocated by the caller, or `NULL`. Receives the image.
+
+		The image is written to memory and the compression is finished. If the image doesn't fit in the caller's buffer, a growing buffer is allocated with `malloc`. `*data` receives it as soon as it's allocated, and if it differs from the caller's buffer, it should be freed by the caller with `free`. The caller's buffer isn't freed then and is left with a part of the image.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function, then `*length` is undefined, but `*data` should be freed as well, if it differs from the caller's buffer.
+
+		\see The header file description.
+	*/
+
+	void Cover_container_write_buffer(
+		struct Cover_container *context,
+		struct jpeg_compress_struct *compressor,
+		size_t *length,
+		uint8_t **data
+	);
+
+	/**
+		Starts tracking of changed rows of blocks for #Cover_container_write_spliced.
+
+		\param context The structure, initialized by #Cover_container_read.
+
+		Library functions, which change coefficients, mark the changed rows. Callers, which change coefficients themselves, should mark them with #Cover_container_mark_changed.
+
+		The tracking array is allocated by LibJPEG and freed with the decompressor.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function.
+
+		\see The header file description.
+	*/
+
+	void Cover_container_track_changes(struct Cover_container *context);
+
+	/**
+		Marks a row of blocks as changed.
+
+		\param context The structure, initialized by #Cover_container_read.
+
+		\param y The index of the row.
+
+		Does nothing if changes aren't tracked.
+
+		\see The header file description.
+	*/
+
+	void Cover_container_mark_changed(struct Cover_container *context, size_t y);
+
+	/**
+		Creates a JPEG image in memory by splicing the original image with re-encoded restart intervals.
+
+		\param context The structure, initialized by #Cover_container_read.
+
+		\param original_length The length of the original image.
+
+		\param original The original image, from which the structure was read.
+
+		\param [out] length Receives the length of the image.
+
+		\param [out] data Receives the image, which should be freed by the caller with `free`, or `NULL` on failure.
+
+		\returns `true` on success or `false` if the image can't be spliced or there is no memory.
+
+		The original image must be sequential and Huffman-coded with one scan. Restart intervals, which contain marked rows, are re-encoded with the original Huffman tables, the rest of the image is copied. If changes aren't tracked, all intervals are re-encoded.
+
+		If the original image has no restart markers, the whole image is re-encoded with a restart marker after each row of MCUs, so the result can be spliced cheaply later.
+
+		The function fails if the tables have no codes for some symbols, then the image should be written by #Cover_container_write.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function, then the caller should free `*data`, which receives the growing buffer as soon as it's allocated.
+
+		\see The header file description.
+	*/
+
+	bool Cover_container_write_spliced(
+		struct Cover_container *context,
+		size_t original_length,
+		const uint8_t *original,
+		size_t *length,
+		uint8_t **data
+	);
 #endif
@@ -7,6 +7,10 @@
 
 	The context should be destroyed with #Cover_Eph5_destroy to free allocated memory.
 
+	The permutation of coefficients depends only on the key and the coefficients count. When many images of the same size are processed with the same key, it can be generated once with #Cover_Eph5_permutation_initialize or loaded from a file with #Cover_Eph5_permutation_load, and then shared by contexts, initialized with #Cover_Eph5_initialize_with_permutation.
+
+	The permutation takes 4 bytes per coefficient, up to 16 GiB for the largest JPEG images. It can be generated in a memory-mapped file with #Cover_Eph5_permutation_initialize_buffer.
+
 	The header file contains an include guard.
 */
 
@@ -23,6 +27,7 @@
 
 	#include <cover/container.h>
 	#include <nettle/arcfour.h>
+	#include <nettle/sha2.h>
 
 	/**
 		Maximum `k` value.
@@ -46,6 +51,159 @@
 
 	void Cover_Eph5_expand_password(uint8_t *key, const char *password);
 
+	/**
+		Permutation structure. It depends only on a key and a coefficients count, so it can be shared by contexts of images with the same count. All its fields are read-only.
+	*/
+
+	struct Cover_Eph5_permutation {
+		/**
+			Count of permuted coefficients.
+		*/
+
+		size_t coefficients_count;
+
+		/**
+			The permutation.
+		*/
+
+		const uint32_t *permutation;
+
+		/**
+			Cipher state after the permutation generation, continued by the keystream.
+		*/
+
+		struct arcfour_ctx cipher;
+
+		/**
+			SHA-256 digest of the key.
+		*/
+
+		uint8_t key_digest[SHA256_DIGEST_SIZE];
+
+		/**
+			Private. The key of the digest of a saved permutation, derived from the key.
+		*/
+
+		uint8_t digest_key[SHA256_DIGEST_SIZE];
+
+		/**
+			Private. The permutation memory, owned by the structure, or `NULL`, if it's provided by the caller or loaded from a file.
+		*/
+
+		void *buffer;
+	};
+
+	/**
+		Generates a permutation.
+
+		\param [out] context The structure to initialize.
+
+		\param key A key, an array of #COVER_EPH5_KEY_LENGTH bytes.
+
+		\param coefficients_count The coefficients count of the images.
+
+		\returns `true` on success or `false` on a memory allocation failure.
+
+		The structure should be destroyed with #Cover_Eph5_permutation_destroy.
+	*/
+
+	bool Cover_Eph5_permutation_initialize(
+		struct Cover_Eph5_permutation *context,
+		const uint8_t *key,
+		size_t coefficients_count
+	);
+
+	/**
+		Calculates the length of a permutation array.
+
+		\param coefficients_count The coefficients count.
+
+		\returns The length in bytes, 4 per coefficient, or 0 if it doesn't fit in `size_t`.
+	*/
+
+	size_t Cover_Eph5_permutation_length(size_t coefficients_count);
+
+	/**
+		Generates a permutation in a caller-provided buffer.
+
+		\param [out] context The structure to initialize.
+
+		\param key A key, an array of #COVER_EPH5_KEY_LENGTH bytes.
+
+		\param coefficients_count The coefficients count of the images.
+
+		\param buffer A buffer of #Cover_Eph5_permutation_length bytes, aligned to 4 bytes. It must remain untouched for the lifetime of the structure.
+
+		\returns `true` on success or `false` if the permutation length doesn't fit in `size_t`.
+
+		Gigapixel images need gigabytes for the permutation, so the buffer can be a shared memory mapping of a file, following a header from #Cover_Eph5_permutation_write_header. The system then writes pages out instead of keeping them all in memory, and the file can be loaded later with #Cover_Eph5_permutation_load.
+
+		The structure should be destroyed with #Cover_Eph5_permutation_destroy, which doesn't free the buffer.
+	*/
+
+	bool Cover_Eph5_permutation_initialize_buffer(
+		struct Cover_Eph5_permutation *context,
+		const uint8_t *key,
+		size_t coefficients_count,
+		void *buffer
+	);
+
+	/**
+		Length of the header of a saved permutation.
+	*/
+
+	#define COVER_EPH5_PERMUTATION_HEADER_LENGTH 344
+
+	/**
+		Creates a header to save a permutation.
+
+		\param context The permutation structure.
+
+		\param [out] header A buffer of #COVER_EPH5_PERMUTATION_HEADER_LENGTH bytes.
+
+		A saved permutation consists of the header, followed by the `context->permutation` array in the native byte order. It can be loaded with #Cover_Eph5_permutation_load, for example, from a memory-mapped file.
+
+		The header contains the cipher state, so saved permutations should be protected as well as keys. It also contains an HMAC-SHA256 digest of the permutation with a key, derived from the key, so the function reads the whole permutation.
+	*/
+
+	void Cover_Eph5_permutation_write_header(const struct Cover_Eph5_permutation *context, uint8_t *header);
+
+	/**
+		Loads a saved permutation without copying.
+
+		\param [out] context The structure to initialize.
+
+		\param key The key, the permutation must have been generated with.
+
+		\param coefficients_count The coefficients count, the permutation must have been generated for.
+
+		\param length The length of the saved permutation.
+
+		\param data The saved permutation, aligned to 4 bytes. It must remain untouched for the lifetime of the structure.
+
+		\returns `true` on success or `false` if the data is not a permutation for this key and count, or was saved on a platform with a different byte order.
+
+		The permutation is verified with its digest, so the function reads the whole data. A damaged or forged permutation, whose indexes could exceed the coefficients count, is rejected.
+
+		The structure should be destroyed with #Cover_Eph5_permutation_destroy.
+	*/
+
+	bool Cover_Eph5_permutation_load(
+		struct Cover_Eph5_permutation *context,
+		const uint8_t *key,
+		size_t coefficients_count,
+		size_t length,
+		const uint8_t *data
+	);
+
+	/**
+		Destroys a permutation structure.
+
+		\param context The structure.
+	*/
+
+	void Cover_Eph5_permutation_destroy(struct Cover_Eph5_permutation *context);
+
 	/**
 		Context structure. All its fields are read-only.
 	*/
@@ -105,10 +263,23 @@
 		uint8_t *usable;
 		uint8_t *one;
 
-		uint32_t *permutation;
+		const uint32_t *permutation;
 		uint8_t *keystream;
 
+		uint8_t *permuted_payload;
+		uint8_t *permuted_one;
+		uint32_t *permuted_indexes;
+		bool gathered;
+
+		struct Cover_Eph5_permutation own_permutation;
+		bool permutation_owned;
+		const struct Cover_Eph5_permutation *deferred_permutation;
+
+		bool bit_arrays_owned;
+
 		uint8_t *changes;
+
+		uint8_t *workspace;
 	};
 
 	/**
@@ -138,6 +309,230 @@
 		bool writable
 	);
 
+	/**
+		Initializes a context, generating the permutation in two threads.
+
+		\param [out] context The context to initialize.
+
+		\param image A container structure, initialized by #Cover_container_read. It must remain untouched by the caller for the lifetime of the context.
+
+		\param key A key, an array of #COVER_EPH5_KEY_LENGTH bytes.
+
+		\param writable Indicates, if the context can be used for embedding.
+
+		\returns `true` on success or `false` on a memory allocation failure.
+
+		Works as #Cover_Eph5_initialize with the same result, but an additional thread produces the RC4 stream, while the calling thread shuffles coefficients, and then produces the keystream, while the last swaps are done. Falls back to one thread, if a thread can't be created.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function, in this case #Cover_Eph5_destroy must be called explicitly to free allocated memory.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Eph5_initialize_concurrently(
+		struct Cover_Eph5 *context,
+		struct Cover_container *image,
+		const uint8_t *key,
+		bool writable
+	);
+
+	/**
+		Calculates the workspace size for #Cover_Eph5_initialize_workspace.
+
+		\param image A container structure, initialized by #Cover_container_read.
+
+		\param writable Indicates, if the context will be used for embedding.
+
+		\returns The size in bytes or 0, if it doesn't fit in `size_t`.
+
+		The size is an upper bound, because the usable coefficients count isn't known before decoding.
+
+		\see The header file description.
+	*/
+
+	size_t Cover_Eph5_workspace_size(const struct Cover_container *image, bool writable);
+
+	/**
+		Initializes a context in a caller-provided workspace.
+
+		\param [out] context The context to initialize.
+
+		\param image A container structure, initialized by #Cover_container_read. It must remain untouched by the caller for the lifetime of the context.
+
+		\param key A key, an array of #COVER_EPH5_KEY_LENGTH bytes.
+
+		\param writable Indicates, if the context can be used for embedding.
+
+		\param workspace A memory block of at least #Cover_Eph5_workspace_size bytes for the same `writable` value, aligned as a `malloc` result. It must remain valid for the lifetime of the context and can be reused after that.
+
+		\returns `true` on success or `false` if the image is too big.
+
+		Works as #Cover_Eph5_initialize, but all arrays are placed in the workspace, so the function doesn't allocate memory. #Cover_Eph5_destroy doesn't free anything for such a context.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Eph5_initialize_workspace(
+		struct Cover_Eph5 *context,
+		struct Cover_container *image,
+		const uint8_t *key,
+		bool writable,
+		void *workspace
+	);
+
+	/**
+		Initializes a context with a shared permutation.
+
+		\param [out] context The context to initialize.
+
+		\param image A container structure, initialized by #Cover_container_read. It must remain untouched by the caller for the lifetime of the context.
+
+		\param permutation A permutation structure for the same coefficients count. It's used read-only and must outlive the context, so it can be shared by many contexts, including in different threads.
+
+		\param writable Indicates, if the context can be used for embedding.
+
+		\returns `true` on success or `false` on a memory allocation failure or if the coefficients counts differ.
+
+		Works as #Cover_Eph5_initialize, but doesn't generate a permutation.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Eph5_initialize_with_permutation(
+		struct Cover_Eph5 *context,
+		struct Cover_container *image,
+		const struct Cover_Eph5_permutation *permutation,
+		bool writable
+	);
+
+	/**
+		Starts an initialization with a shared permutation, leaving the decoding to the caller.
+
+		\param [out] context The context to initialize.
+
+		\param image A container structure, initialized by #Cover_container_read. It must remain untouched by the caller for the lifetime of the context.
+
+		\param permutation A permutation structure for the same coefficients count, as for #Cover_Eph5_initialize_with_permutation.
+
+		\param writable Indicates, if the context can be used for embedding.
+
+		\param [out] visitor Receives a visitor, which decodes the coefficients. It should be passed to #Cover_container_visit, possibly along with visitors of other contexts of the same image, and then the initialization should be finished with #Cover_Eph5_complete_deferred.
+
+		\returns `true` on success or `false` on a memory allocation failure or if the coefficients counts differ.
+
+		If the initialization isn't finished, the context should be destroyed with #Cover_Eph5_destroy.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Eph5_initialize_deferred(
+		struct Cover_Eph5 *context,
+		struct Cover_container *image,
+		const struct Cover_Eph5_permutation *permutation,
+		bool writable,
+		struct Cover_container_visitor *visitor
+	);
+
+	/**
+		Finishes an initialization, started by #Cover_Eph5_initialize_deferred.
+
+		\param context The context, which coefficients have been visited.
+
+		\returns `true` on success or `false` on a memory allocation failure, in this case the context is destroyed.
+
+		The result is the same as of #Cover_Eph5_initialize_with_permutation.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Eph5_complete_deferred(struct Cover_Eph5 *context);
+
+	/**
+		Initializes an extraction-only context, decoding the coefficients while they are read.
+
+		\param [out] context The context to initialize.
+
+		\param image A container structure, initialized by #Cover_container_read_header. It must remain untouched by the caller for the lifetime of the context.
+
+		\param permutation A permutation structure for the same coefficients count. It must outlive the context.
+
+		\returns `true` on success or `false` on a memory allocation failure or if the coefficients counts differ.
+
+		Works as #Cover_Eph5_initialize_with_permutation, but reads the coefficients with #Cover_container_scan, so they are never kept in memory. Progressive images can't be scanned, their coefficients are read with #Cover_container_read_coefficients instead.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function, in this case #Cover_Eph5_destroy must be called explicitly to free allocated memory.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Eph5_initialize_streaming(
+		struct Cover_Eph5 *context,
+		struct Cover_container *image,
+		const struct Cover_Eph5_permutation *permutation
+	);
+
+	/**
+		Only decodes coefficients of an image into a source context for #Cover_Eph5_initialize_shared.
+
+		\param [out] context The context to initialize.
+
+		\param image A container structure, initialized by #Cover_container_read_header. It must outlive the context.
+
+		\returns `true` on success or `false` on a memory allocation failure.
+
+		The coefficients are read with #Cover_container_scan, so they are never kept in memory. Coefficients of progressive images are read with #Cover_container_read_coefficients instead.
+
+		No permutation or keystream is generated, so the context can't be used for extraction or embedding itself. It should be destroyed with #Cover_Eph5_destroy.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function, in this case #Cover_Eph5_destroy must be called explicitly to free allocated memory.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Eph5_initialize_decoded(struct Cover_Eph5 *context, struct Cover_container *image);
+
+	/**
+		Initializes an extraction-only context for another key, sharing decoded coefficients with an existing context.
+
+		\param [out] context The context to initialize.
+
+		\param source An initialized context of the image, for example by #Cover_Eph5_initialize_decoded. It's used read-only and must outlive the new context, so many contexts can share it, including in different threads.
+
+		\param permutation A permutation structure for the new key and the same coefficients count. It must outlive the context.
+
+		\returns `true` on success or `false` on a memory allocation failure or if the coefficients counts differ.
+
+		Only the keystream is generated, the image isn't read again. Useful to try many keys against one image.
+
+		The context should be destroyed with #Cover_Eph5_destroy before the source context.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Eph5_initialize_shared(
+		struct Cover_Eph5 *context,
+		const struct Cover_Eph5 *source,
+		const struct Cover_Eph5_permutation *permutation
+	);
+
+	/**
+		Only counts coefficients and estimates capacities of an image.
+
+		\param [out] context The context to initialize. Only the `image`, `usable_count`, `one_count` fields and the capacity arrays are valid.
+
+		\param image A container structure, initialized by #Cover_container_read or only by #Cover_container_read_header. In the latter case the coefficients are passed through #Cover_container_scan, or read with #Cover_container_read_coefficients if the image is progressive.
+
+		Doesn't need a key and doesn't allocate memory. With a scanned image it costs little more than the Huffman decoding. The context can't be used for extraction or embedding, destroying it with #Cover_Eph5_destroy is optional.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function.
+
+		\see The header file description.
+	*/
+
+	void Cover_Eph5_analyze(struct Cover_Eph5 *context, struct Cover_container *image);
+
 	/**
 		Destroys a context.
 
@@ -153,7 +548,7 @@
 
 		\param [out] zeroed_count Saves count of zeroed coefficients here.
 
-		Changes coefficients of the `context->image` structure. #Cover_container_write can be used to create a JPEG image from it.
+		Changes coefficients of the `context->image` structure. #Cover_container_write can be used to create a JPEG image from it. Changed rows are marked with #Cover_container_mark_changed.
 
 		After a call, the context should be destroyed with #Cover_Eph5_destroy - other actions are undefined.
 
@@ -180,6 +575,44 @@
 
 	void Cover_Eph5_extract(struct Cover_Eph5 *context, uint8_t **data);
 
+	/**
+		Extracts data for all `k` values, passing it to a callback in chunks.
+
+		\param context An initialized context.
+
+		\param write A callback, which receives the `argument`, a `k` value and a chunk of data of the given length. The chunks for each `k` value come in order, but chunks of different `k` values are interleaved. It should return `false` to stop the extraction.
+
+		\param argument An argument for the callback.
+
+		\returns `false` if the callback stopped the extraction, `true` otherwise.
+
+		Produces the same data as #Cover_Eph5_extract, but uses a few kilobytes of buffers instead of the caller's output arrays of the `context->extractable_length` lengths.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Eph5_extract_stream(
+		struct Cover_Eph5 *context,
+		bool (*write)(void *argument, int k, size_t length, const uint8_t *data),
+		void *argument
+	);
+
+	/**
+		Extracts only the beginning of the data for the requested `k` values.
+
+		\param context An initialized context.
+
+		\param lengths An array of #COVER_EPH5_MAXIMUM_K byte counts to extract. Each count must not exceed the corresponding value from the `context->extractable_length` list, 0 means to skip the `k` value.
+
+		\param [out] data An array of #COVER_EPH5_MAXIMUM_K output arrays of the requested lengths. Arrays for skipped `k` values may be `NULL`.
+
+		The permutation is walked directly and only until all requested bytes are extracted, so reading a short header costs a small fraction of #Cover_Eph5_extract. The result is the same as a prefix of the #Cover_Eph5_extract result.
+
+		\see The header file description.
+	*/
+
+	void Cover_Eph5_extract_bounded(struct Cover_Eph5 *context, const size_t *lengths, uint8_t **data);
+
 	/**
 		Embeds data.
 
@@ -199,4 +632,26 @@
 	*/
 
 	size_t Cover_Eph5_embed(struct Cover_Eph5 *context, size_t length, const uint8_t *data, int k);
+
+	/**
+		Embeds data with the greatest `k` value, which fits.
+
+		\param context An initialized context.
+
+		\param length The length of the data.
+
+		\param data The data.
+
+		\param k The greatest `k` value to try, from 1 to #COVER_EPH5_MAXIMUM_K.
+
+		\param [out] embedded_length Saves count of embedded bytes here, it's less than the data length if the data doesn't fit even with `k` = 1.
+
+		The same as calling #Cover_Eph5_embed with decreasing `k` values until the data fits, but `k` values with insufficient `context->maximum_capacity` are skipped without walking the coefficients, and a failing attempt stops as soon as the remaining usable coefficients can't hold the remaining groups of `2^k - 1` coefficients. Shrinkage is known only while embedding, so in the worst case each `k` value from the greatest one with sufficient `context->maximum_capacity` down to the chosen one still walks most of the usable coefficients.
+
+		\returns The chosen `k` value. The planned changes are for it.
+
+		\see The header file description.
+	*/
+
+	int Cover_Eph5_embed_fit(struct Cover_Eph5 *context, size_t length, const uint8_t *data, int k, size_t *embedded_length);
 #endif
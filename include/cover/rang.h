@@ -7,7 +7,9 @@
 
 	The context should be destroyed with #Cover_Rang_destroy to free allocated memory.
 
-	The embedding algorithm needs two images with unnoticable differences: clear and modified. #Cover_Rang_modify_image can be used to derive a modified image from a clear.
+	The embedding algorithm needs two images with unnoticable differences: clear and modified. #Cover_Rang_modify_image can be used to derive a modified image from a clear. The images are independent until #Cover_Rang_initialize, so they can be decoded with #Cover_container_read in two threads.
+
+	Big data can be split into segments with #Cover_Rang_split and spread over several images with #Cover_Rang_embed_segment. Each segment carries a small header, so #Cover_Rang_extract_segment_header and #Cover_Rang_extract_segment can extract it without knowing the data length.
 
 	Low-level hashing functions are also provided. They can be used to apply Rang-Hash to other image and media formats or to implement Rang-JPEG with data blocks separation.
 
@@ -238,6 +240,8 @@
 		uint8_t *direction;
 
 		uint8_t *changes;
+
+		uint8_t *workspace;
 	};
 
 	/**
@@ -269,6 +273,78 @@
 		const uint8_t *entropy
 	);
 
+	/**
+		Initializes a context, leaving the decoding to the caller.
+
+		\param [out] context The context to initialize.
+
+		\param clear A clear image, initialized by #Cover_container_read. It must remain untouched by the caller for the lifetime of the context.
+
+		\param modified A modififed image or `NULL`, as for #Cover_Rang_initialize.
+
+		\param entropy #COVER_RANG_ENTROPY_LENGTH random bytes, or `NULL` if `modififed` is `NULL`.
+
+		\param [out] visitor Receives a visitor, which decodes the coefficients of the clear image. The context can be used after the visitor is passed to #Cover_container_visit, possibly along with visitors of other contexts of the same image.
+
+		\returns `true` on success or `false` on a memory allocation failure.
+
+		The context should be destroyed with #Cover_Rang_destroy.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Rang_initialize_deferred(
+		struct Cover_Rang *context,
+		struct Cover_container *clear,
+		struct Cover_container *modified,
+		const uint8_t *entropy,
+		struct Cover_container_visitor *visitor
+	);
+
+	/**
+		Calculates the workspace size for #Cover_Rang_initialize_workspace.
+
+		\param clear A clear image, initialized by #Cover_container_read.
+
+		\param modified The modified image or `NULL`, which will be passed to #Cover_Rang_initialize_workspace.
+
+		\returns The size in bytes or 0, if it doesn't fit in `size_t`.
+
+		\see The header file description.
+	*/
+
+	size_t Cover_Rang_workspace_size(const struct Cover_container *clear, const struct Cover_container *modified);
+
+	/**
+		Initializes a context in a caller-provided workspace.
+
+		\param [out] context The context to initialize.
+
+		\param clear A clear image, initialized by #Cover_container_read. It must remain untouched by the caller for the lifetime of the context.
+
+		\param modified A modififed image or `NULL`, as for #Cover_Rang_initialize.
+
+		\param entropy #COVER_RANG_ENTROPY_LENGTH random bytes, or `NULL` if `modififed` is `NULL`.
+
+		\param workspace A memory block of at least #Cover_Rang_workspace_size bytes for the same images, aligned as a `malloc` result. It must remain valid for the lifetime of the context and can be reused after that.
+
+		\returns `true` on success or `false` if the image is too big.
+
+		Works as #Cover_Rang_initialize, but all arrays are placed in the workspace, so the function doesn't allocate memory. #Cover_Rang_destroy doesn't free anything for such a context.
+
+		LibJPEG errors must be handled by the caller. It's safe to `longjmp` through the function.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Rang_initialize_workspace(
+		struct Cover_Rang *context,
+		struct Cover_container *clear,
+		struct Cover_container *modified,
+		const uint8_t *entropy,
+		void *workspace
+	);
+
 	/**
 		Destroys a context.
 
@@ -282,7 +358,7 @@
 
 		\param context An initialized context.
 
-		Changes coefficients of the `context->clear` structure. #Cover_container_write can be used to create a JPEG image from it.
+		Changes coefficients of the `context->clear` structure. #Cover_container_write can be used to create a JPEG image from it. Changed rows are marked with #Cover_container_mark_changed.
 
 		After a call, the context should be destroyed with #Cover_Rang_destroy - other actions are undefined.
 
@@ -311,6 +387,26 @@
 
 	void Cover_Rang_extract(struct Cover_Rang *context, size_t length, uint8_t *data);
 
+	/**
+		Extracts a part of data.
+
+		\param context An initialized context.
+
+		\param start The index of the first coefficient to hash.
+
+		\param count The count of coefficients to hash. The range must lie within the image.
+
+		\param length The data length.
+
+		\param [out] data The output data array.
+
+		Only the given range of coefficients is hashed. Xored together, the parts of non-overlapping ranges, which cover the whole image, give the same result as #Cover_Rang_extract, so the parts can be computed by different threads or processes.
+
+		\see The header file description.
+	*/
+
+	void Cover_Rang_extract_part(struct Cover_Rang *context, size_t start, size_t count, size_t length, uint8_t *data);
+
 	/**
 		Tries to embed data.
 
@@ -332,4 +428,105 @@
 	*/
 
 	int Cover_Rang_embed(struct Cover_Rang *context, size_t length, const uint8_t *data, size_t padding_bits_count);
+
+	/**
+		Length of a segment header.
+	*/
+
+	#define COVER_RANG_SEGMENT_HEADER_LENGTH 8
+
+	/**
+		Maximum count of segments.
+	*/
+
+	#define COVER_RANG_MAXIMUM_SEGMENTS_COUNT 65535
+
+	/**
+		Maximum length of segment data.
+	*/
+
+	#define COVER_RANG_MAXIMUM_SEGMENT_LENGTH 65535
+
+	/**
+		Splits data into segments for embedding into several images.
+
+		\param count The count of images, from 1 to #COVER_RANG_MAXIMUM_SEGMENTS_COUNT.
+
+		\param capacities An array of `count` image capacities in bytes. The capacity of an image is the number of its usable bits without padding bits, divided by 8.
+
+		\param length The data length.
+
+		\param [out] lengths An array of `count` items to store data lengths of the segments. Each segment also takes #COVER_RANG_SEGMENT_HEADER_LENGTH bytes of its image capacity.
+
+		The data is distributed as evenly as the capacities allow, because the embedding time grows as a cube of the data length. Segments may be empty.
+
+		\returns `true` on success or `false` if the total capacity is insufficient.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Rang_split(size_t count, const size_t *capacities, size_t length, size_t *lengths);
+
+	/**
+		Tries to embed a data segment.
+
+		\param context An initialized context.
+
+		\param index The index of the segment.
+
+		\param count The count of segments, not greater than #COVER_RANG_MAXIMUM_SEGMENTS_COUNT.
+
+		\param length The length of the segment data, not greater than #COVER_RANG_MAXIMUM_SEGMENT_LENGTH.
+
+		\param data The segment data.
+
+		\param padding_bits_count The count of padding bits.
+
+		Prepends a header with the segment index, the segments count, the data length and a checksum of these fields and embeds the result with #Cover_Rang_embed. Contexts of different images can be used in different threads.
+
+		\returns The same values as #Cover_Rang_embed.
+
+		\see The header file description.
+	*/
+
+	int Cover_Rang_embed_segment(
+		struct Cover_Rang *context,
+		size_t index,
+		size_t count,
+		size_t length,
+		const uint8_t *data,
+		size_t padding_bits_count
+	);
+
+	/**
+		Extracts a segment header.
+
+		\param context An initialized context.
+
+		\param [out] index The segment index.
+
+		\param [out] count The count of segments.
+
+		\param [out] length The length of the segment data.
+
+		\returns `false` if the checksum doesn't match or the index is out of range, which means that the image doesn't contain a segment.
+
+		\see The header file description.
+	*/
+
+	bool Cover_Rang_extract_segment_header(struct Cover_Rang *context, size_t *index, size_t *count, size_t *length);
+
+	/**
+		Extracts a segment.
+
+		\param context An initialized context.
+
+		\param length The length of the segment data, read by #Cover_Rang_extract_segment_header.
+
+		\param [out] data An array of `COVER_RANG_SEGMENT_HEADER_LENGTH + length` bytes. The header is stored first, the segment data follows it.
+
+		\see The header file description.
+	*/
+
+	void Cover_Rang_extract_segment(struct Cover_Rang *context, size_t length, uint8_t *data);
 #endif
@@ -0,0 +1,57 @@
+#ifndef BITS_H
+	#define BITS_H
+
+	#include <stddef.h>
+	#include <stdint.h>
+
+	static inline int count_bits(uint_fast64_t bits) {
+		#ifdef __GNUC__
+			return __builtin_popcountll(bits);
+		#else
+			int result = 0;
+
+			for (; bits != 0; bits &= bits - 1) {
+				++result;
+			}
+
+			return result;
+		#endif
+	}
+
+	static inline int lowest_bit(uint_fast64_t bits) {
+		#ifdef __GNUC__
+			return __builtin_ctzll(bits);
+		#else
+			int result = 0;
+
+			for (; (bits & 1) == 0; bits >>= 1) {
+				++result;
+			}
+
+			return result;
+		#endif
+	}
+
+	static inline void store_bits(uint8_t *array, uint_fast64_t bits) {
+		for (int i = 0; i < 8; ++i) {
+			array[i] = bits >> 8 * i & 0xff;
+		}
+	}
+
+	// Loads 64 bits starting from the bit `start`, reads 9 bytes
+
+	static inline uint_fast64_t load_bits(const uint8_t *array, size_t start) {
+		const uint8_t *bytes = array + start / 8;
+		uint_fast64_t bits = 0;
+
+		for (int i = 0; i < 8; ++i) {
+			bits |= (uint_fast64_t) bytes[i] << 8 * i;
+		}
+
+		if (start % 8 != 0) {
+			bits = bits >> start % 8 | (uint_fast64_t) bytes[8] << (64 - start % 8);
+		}
+
+		return bits;
+	}
+#endif
@@ -1,12 +1,16 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 
 #include <cover/container.h>
 #include <jpeglib.h>
+#include <jerror.h>
 
-bool Cover_container_read(struct Cover_container *context, struct jpeg_decompress_struct *decompressor) {
+bool Cover_container_read_header(struct Cover_container *context, struct jpeg_decompress_struct *decompressor) {
 	context->decompressor = decompressor;
 
 	jpeg_read_header(decompressor, true);
@@ -19,8 +23,6 @@ bool Cover_container_read(struct Cover_container *context, struct jpeg_decompres
 		return false;
 	}
 
-	context->coefficients_arrays = jpeg_read_coefficients(decompressor);
-
 	jpeg_component_info *component = &decompressor->comp_info[COVER_CONTAINER_COMPONENT_INDEX];
 
 	size_t width_in_blocks = (
@@ -39,23 +41,408 @@ bool Cover_container_read(struct Cover_container *context, struct jpeg_decompres
 	context->height_in_blocks = height_in_blocks;
 	context->coefficients_count = width_in_blocks * height_in_blocks * COVER_CONTAINER_BLOCK_LENGTH;
 
+	context->coefficients = NULL;
+	context->coefficients_arrays = NULL;
+	context->changed_rows = NULL;
+
+	return true;
+}
+
+void Cover_container_read_coefficients(struct Cover_container *context) {
+	context->coefficients_arrays = jpeg_read_coefficients(context->decompressor);
 	context->coefficients = context->coefficients_arrays[COVER_CONTAINER_COMPONENT_INDEX];
+}
+
+bool Cover_container_read(struct Cover_container *context, struct jpeg_decompress_struct *decompressor) {
+	if (!Cover_container_read_header(context, decompressor)) {
+		return false;
+	}
+
+	Cover_container_read_coefficients(context);
 
 	return true;
 }
 
-void Cover_container_write(struct Cover_container *context, struct jpeg_compress_struct *compressor) {
-	jpeg_copy_critical_parameters(context->decompressor, compressor);
+bool Cover_container_read_buffer(
+	struct Cover_container *context,
+	struct jpeg_decompress_struct *decompressor,
+	size_t length,
+	const uint8_t *data
+) {
+	if (length > ULONG_MAX) {
+		return false;
+	}
 
-	if (context->decompressor->progressive_mode) {
-		jpeg_simple_progression(compressor);
+	jpeg_mem_src(decompressor, (unsigned char *) data, length);
+
+	return Cover_container_read(context, decompressor);
+}
+
+// The scanner replaces the memory manager of a decompressor for the time of reading. Whole-image coefficient arrays
+// become windows of one iMCU row, the rows of the used component are passed to the visitor before the window moves.
+// Other calls are forwarded to the original manager, which expects to be installed when called.
+
+struct scanned_array {
+	JDIMENSION width_in_blocks;
+	JDIMENSION height_in_blocks;
+
+	JBLOCKARRAY window;
+	JDIMENSION window_height;
+	JDIMENSION window_y;
+	bool window_filled;
+};
+
+struct row_scanner {
+	struct jpeg_memory_mgr manager;
+	struct jpeg_memory_mgr *original_manager;
+
+	void (*visit)(void *argument, size_t y, JBLOCKROW row);
+	void *argument;
+
+	size_t requested_count;
+	struct scanned_array *visited_array;
+};
+
+#define ORIGINAL_MANAGER_CALL(decompressor, call) { \
+	struct row_scanner *scanner = (struct row_scanner *) decompressor->mem; \
+	\
+	decompressor->mem = scanner->original_manager; \
+	call; \
+	decompressor->mem = &scanner->manager; \
+}
+
+static void *alloc_small(j_common_ptr decompressor, int pool_id, size_t size) {
+	void *result;
+
+	ORIGINAL_MANAGER_CALL(decompressor, result = decompressor->mem->alloc_small(decompressor, pool_id, size));
+
+	return result;
+}
+
+static void *alloc_large(j_common_ptr decompressor, int pool_id, size_t size) {
+	void *result;
+
+	ORIGINAL_MANAGER_CALL(decompressor, result = decompressor->mem->alloc_large(decompressor, pool_id, size));
+
+	return result;
+}
+
+static JSAMPARRAY alloc_sarray(j_common_ptr decompressor, int pool_id, JDIMENSION width, JDIMENSION height) {
+	JSAMPARRAY result;
+
+	ORIGINAL_MANAGER_CALL(decompressor, result = decompressor->mem->alloc_sarray(decompressor, pool_id, width, height));
+
+	return result;
+}
+
+static JBLOCKARRAY alloc_barray(j_common_ptr decompressor, int pool_id, JDIMENSION width, JDIMENSION height) {
+	JBLOCKARRAY result;
+
+	ORIGINAL_MANAGER_CALL(decompressor, result = decompressor->mem->alloc_barray(decompressor, pool_id, width, height));
+
+	return result;
+}
+
+static jvirt_sarray_ptr request_virt_sarray(
+	j_common_ptr decompressor,
+	int pool_id,
+	boolean pre_zero,
+	JDIMENSION width,
+	JDIMENSION height,
+	JDIMENSION maximum_access
+) {
+	jvirt_sarray_ptr result;
+
+	ORIGINAL_MANAGER_CALL(decompressor, result = decompressor->mem->request_virt_sarray(
+		decompressor, pool_id, pre_zero, width, height, maximum_access
+	));
+
+	return result;
+}
+
+static void realize_virt_arrays(j_common_ptr decompressor) {
+	ORIGINAL_MANAGER_CALL(decompressor, decompressor->mem->realize_virt_arrays(decompressor));
+}
+
+static JSAMPARRAY access_virt_sarray(
+	j_common_ptr decompressor,
+	jvirt_sarray_ptr array,
+	JDIMENSION y,
+	JDIMENSION height,
+	boolean writable
+) {
+	JSAMPARRAY result;
+
+	ORIGINAL_MANAGER_CALL(decompressor, result = decompressor->mem->access_virt_sarray(
+		decompressor, array, y, height, writable
+	));
+
+	return result;
+}
+
+static void free_pool(j_common_ptr decompressor, int pool_id) {
+	ORIGINAL_MANAGER_CALL(decompressor, decompressor->mem->free_pool(decompressor, pool_id));
+}
+
+static void self_destruct(j_common_ptr decompressor) {
+	struct row_scanner *scanner = (struct row_scanner *) decompressor->mem;
+	struct jpeg_memory_mgr *original_manager = scanner->original_manager; // The scanner is freed here
+
+	decompressor->mem = original_manager;
+	original_manager->self_destruct(decompressor);
+}
+
+// LibJPEG requests one coefficient array per component, in the order of components
+
+static jvirt_barray_ptr request_virt_barray(
+	j_common_ptr decompressor,
+	int pool_id,
+	boolean pre_zero,
+	JDIMENSION width,
+	JDIMENSION height,
+	JDIMENSION maximum_access
+) {
+	struct row_scanner *scanner = (struct row_scanner *) decompressor->mem;
+
+	struct scanned_array *array = alloc_small(decompressor, pool_id, sizeof *array);
+
+	array->width_in_blocks = width;
+	array->height_in_blocks = height;
+	array->window = alloc_barray(decompressor, pool_id, width, maximum_access);
+	array->window_height = maximum_access;
+	array->window_y = 0;
+	array->window_filled = false;
+
+	if (scanner->requested_count == COVER_CONTAINER_COMPONENT_INDEX) {
+		scanner->visited_array = array;
 	}
 
-	compressor->optimize_coding = true;
+	++scanner->requested_count;
 
-	jpeg_write_coefficients(compressor, context->coefficients_arrays);
+	return (jvirt_barray_ptr) array;
+}
+
+static void flush_window(struct row_scanner *scanner, struct scanned_array *array) {
+	if (array != scanner->visited_array || !array->window_filled) {
+		return;
+	}
+
+	for (JDIMENSION i = 0; i < array->window_height && array->window_y + i < array->height_in_blocks; ++i) {
+		scanner->visit(scanner->argument, array->window_y + i, array->window[i]);
+	}
+}
+
+static JBLOCKARRAY access_virt_barray(
+	j_common_ptr decompressor,
+	jvirt_barray_ptr pointer,
+	JDIMENSION y,
+	JDIMENSION height,
+	boolean writable
+) {
+	struct row_scanner *scanner = (struct row_scanner *) decompressor->mem;
+	struct scanned_array *array = (struct scanned_array *) pointer;
+
+	if (height > array->window_height || y + height > array->height_in_blocks || array->window_filled && y < array->window_y) {
+		ERREXIT(decompressor, JERR_BAD_VIRTUAL_ACCESS);
+	}
+
+	if (!array->window_filled || y != array->window_y) {
+		flush_window(scanner, array);
+
+		// The decoder expects zeroed blocks, as in pre-zeroed arrays
+
+		for (JDIMENSION i = 0; i < array->window_height; ++i) {
+			memset(array->window[i], 0, array->width_in_blocks * sizeof (JBLOCK));
+		}
+
+		array->window_y = y;
+		array->window_filled = true;
+	}
+
+	return array->window;
+}
+
+bool Cover_container_scan(struct Cover_container *context, void (*visit)(void *argument, size_t y, JBLOCKROW row), void *argument) {
+	struct jpeg_decompress_struct *decompressor = context->decompressor;
+
+	if (decompressor->progressive_mode) {
+		return false; // Every scan revisits the rows
+	}
+
+	struct jpeg_memory_mgr *original_manager = decompressor->mem;
+
+	struct row_scanner *scanner = original_manager->alloc_small(
+		(struct jpeg_common_struct *) decompressor,
+		JPOOL_PERMANENT, sizeof *scanner
+	); // Stays alive if LibJPEG throws while installed, so the decompressor can be destroyed
+
+	scanner->manager = (struct jpeg_memory_mgr) {
+		.alloc_small = alloc_small,
+		.alloc_large = alloc_large,
+		.alloc_sarray = alloc_sarray,
+		.alloc_barray = alloc_barray,
+		.request_virt_sarray = request_virt_sarray,
+		.request_virt_barray = request_virt_barray,
+		.realize_virt_arrays = realize_virt_arrays,
+		.access_virt_sarray = access_virt_sarray,
+		.access_virt_barray = access_virt_barray,
+		.free_pool = free_pool,
+		.self_destruct = self_destruct,
+		.max_memory_to_use = original_manager->max_memory_to_use,
+		.max_alloc_chunk = original_manager->max_alloc_chunk
+	};
+
+	scanner->original_manager = original_manager;
+	scanner->visit = visit;
+	scanner->argument = argument;
+	scanner->requested_count = 0;
+	scanner->visited_array = NULL;
+
+	decompressor->mem = &scanner->manager;
+
+	jpeg_read_coefficients(decompressor);
+
+	if (scanner->visited_array != NULL) {
+		flush_window(scanner, scanner->visited_array);
+	}
+
+	decompressor->mem = original_manager;
+
+	return true;
+}
+
+// The plane can be the array itself, if LibJPEG keeps the whole array in memory and has allocated its rows in one chunk
+
+static JCOEF *find_plane(struct Cover_container *context) {
+	struct jpeg_decompress_struct *decompressor = context->decompressor;
+	struct jvirt_barray_control *coefficients = context->coefficients;
+
+	JCOEF *plane = NULL;
+
+	for (JDIMENSION y = 0; y < context->height_in_blocks; ++y) {
+		JBLOCKARRAY buffer = decompressor->mem->access_virt_barray(
+			(struct jpeg_common_struct *) decompressor,
+			coefficients, y, 1, false
+		);
+
+		if (y == 0) {
+			plane = buffer[0][0];
+		} else if (buffer[0][0] != plane + COVER_CONTAINER_BLOCK_LENGTH * context->width_in_blocks * y) {
+			return NULL;
+		}
+	}
+
+	return plane;
+}
+
+bool Cover_container_export_plane(struct Cover_container *context, struct Cover_container_plane *plane) {
+	plane->buffer = NULL;
+	plane->coefficients = find_plane(context);
+	plane->copied = plane->coefficients == NULL;
+
+	if (!plane->copied) {
+		return true;
+	}
+
+	if (SIZE_MAX / sizeof (JCOEF) < context->coefficients_count) {
+		return false;
+	}
+
+	plane->buffer = malloc(sizeof (JCOEF) * context->coefficients_count);
+
+	if (plane->buffer == NULL) {
+		return false;
+	}
+
+	plane->coefficients = plane->buffer;
+
+	struct jpeg_decompress_struct *decompressor = context->decompressor;
+	size_t row_length = COVER_CONTAINER_BLOCK_LENGTH * context->width_in_blocks;
+
+	for (JDIMENSION y = 0; y < context->height_in_blocks; ++y) {
+		JBLOCKARRAY buffer = decompressor->mem->access_virt_barray(
+			(struct jpeg_common_struct *) decompressor,
+			context->coefficients, y, 1, false
+		);
 
-	// Fix dummy blocks
+		memcpy(plane->coefficients + row_length * y, buffer[0], sizeof (JCOEF) * row_length);
+	}
+
+	return true;
+}
+
+void Cover_container_import_plane(struct Cover_container *context, const JCOEF *coefficients) {
+	struct jpeg_decompress_struct *decompressor = context->decompressor;
+	size_t row_length = COVER_CONTAINER_BLOCK_LENGTH * context->width_in_blocks;
+
+	for (JDIMENSION y = 0; y < context->height_in_blocks; ++y) {
+		JBLOCKARRAY buffer = decompressor->mem->access_virt_barray(
+			(struct jpeg_common_struct *) decompressor,
+			context->coefficients, y, 1, true
+		);
+
+		// Rows of a plane, which is the array itself, are already in place
+
+		if (buffer[0][0] != coefficients + row_length * y) {
+			memcpy(buffer[0], coefficients + row_length * y, sizeof (JCOEF) * row_length);
+		}
+	}
+}
+
+void Cover_container_plane_destroy(struct Cover_container_plane *plane) {
+	free(plane->buffer);
+}
+
+// All visitors process a batch of rows, while it's still in the cache. A batch has at least one row.
+
+#define VISIT_BATCH_LENGTH (256 * 1024)
+
+void Cover_container_visit(struct Cover_container *context, const struct Cover_container_visitor *visitors, size_t visitors_count) {
+	struct jpeg_decompress_struct *decompressor = context->decompressor;
+
+	size_t height_in_blocks = context->height_in_blocks;
+	size_t row_length = COVER_CONTAINER_BLOCK_LENGTH * context->width_in_blocks;
+
+	// Rows of a batch are accessed again by every visitor, which is cheap only for a whole array in memory. Otherwise LibJPEG moves its window to each accessed row, so the last and the first rows come at the same address.
+
+	size_t batch_height = 1;
+
+	if (height_in_blocks > 1) {
+		JBLOCKROW last_row = decompressor->mem->access_virt_barray(
+			(struct jpeg_common_struct *) decompressor,
+			context->coefficients, height_in_blocks - 1, 1, false
+		)[0];
+
+		JBLOCKROW first_row = decompressor->mem->access_virt_barray(
+			(struct jpeg_common_struct *) decompressor,
+			context->coefficients, 0, 1, false
+		)[0];
+
+		if (last_row != first_row && sizeof (JCOEF) * row_length < VISIT_BATCH_LENGTH) {
+			batch_height = VISIT_BATCH_LENGTH / (sizeof (JCOEF) * row_length);
+		}
+	}
+
+	for (size_t start = 0; start < height_in_blocks; start += batch_height) {
+		size_t end = start + batch_height < height_in_blocks ? start + batch_height : height_in_blocks;
+
+		for (size_t i = 0; i < visitors_count; ++i) {
+			for (size_t y = start; y < end; ++y) {
+				JBLOCKROW row = decompressor->mem->access_virt_barray(
+					(struct jpeg_common_struct *) decompressor,
+					context->coefficients, y, 1, false
+				)[0];
+
+				visitors[i].visit(visitors[i].argument, y, row);
+			}
+		}
+	}
+}
+
+// Dummy blocks are written as they are, instead of LibJPEG's copies of the last real block
+
+static void write_coefficients(struct Cover_container *context, struct jpeg_compress_struct *compressor) {
+	jpeg_write_coefficients(compressor, context->coefficients_arrays);
 
 	jpeg_component_info *component = &context->decompressor->comp_info[COVER_CONTAINER_COMPONENT_INDEX];
 
@@ -67,3 +454,804 @@ void Cover_container_write(struct Cover_container *context, struct jpeg_compress
 		component->height_in_blocks + component->MCU_height - 1
 	) / component->MCU_height * component->MCU_height;
 }
+
+void Cover_container_write(struct Cover_container *context, struct jpeg_compress_struct *compressor) {
+	jpeg_copy_critical_parameters(context->decompressor, compressor);
+
+	if (context->decompressor->progressive_mode) {
+		jpeg_simple_progression(compressor);
+	}
+
+	compressor->optimize_coding = true;
+
+	write_coefficients(context, compressor);
+}
+
+// Natural positions of coefficients in the zig-zag order
+
+static const uint8_t natural_order[COVER_CONTAINER_BLOCK_LENGTH] = {
+	0, 1, 8, 16, 9, 2, 3, 10,
+	17, 24, 32, 25, 18, 11, 4, 5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63
+};
+
+#define HUFFMAN_SYMBOLS_COUNT 256
+#define MAXIMUM_CATEGORY 15
+
+static int get_category(int_fast32_t value) {
+	uint_fast32_t magnitude = value < 0 ? -value : value;
+	int result = 0;
+
+	for (; magnitude != 0; magnitude >>= 1) {
+		++result;
+	}
+
+	return result;
+}
+
+static void mark_coded_symbols(bool *coded, const JHUFF_TBL *table) {
+	int count = 0;
+
+	for (int i = 1; i <= 16; ++i) {
+		count += table->bits[i];
+	}
+
+	for (int i = 0; i < count && i < HUFFMAN_SYMBOLS_COUNT; ++i) {
+		coded[table->huffval[i]] = true;
+	}
+}
+
+struct coded_symbols {
+	bool dc[HUFFMAN_SYMBOLS_COUNT];
+	bool ac[HUFFMAN_SYMBOLS_COUNT];
+};
+
+// Checks the symbols of a block in the way the sequential Huffman encoder produces them
+
+static bool is_block_coded(const struct coded_symbols *coded, const JCOEF *block, int_fast32_t *last_dc) {
+	int dc_category = get_category(block[0] - *last_dc);
+
+	*last_dc = block[0];
+
+	if (dc_category > MAXIMUM_CATEGORY || !coded->dc[dc_category]) {
+		return false;
+	}
+
+	int run = 0;
+
+	for (int i = 1; i < COVER_CONTAINER_BLOCK_LENGTH; ++i) {
+		JCOEF value = block[natural_order[i]];
+
+		if (value == 0) {
+			++run;
+
+			continue;
+		}
+
+		for (; run > 15; run -= 16) {
+			if (!coded->ac[0xf0]) {
+				return false; // ZRL
+			}
+		}
+
+		int ac_category = get_category(value);
+
+		if (ac_category > MAXIMUM_CATEGORY || !coded->ac[run << 4 | ac_category]) {
+			return false;
+		}
+
+		run = 0;
+	}
+
+	return run == 0 || coded->ac[0x00]; // EOB
+}
+
+// The tables can be reused only if the image has one sequential Huffman-coded scan, so that the tables in the slots are the used
+// ones. Other components are unchanged and keep the restart interval, so their DC differences and symbols are the same. The
+// blocks of the used component are checked in the order of the new scan, because DC coefficients are coded as differences,
+// which restart at each interval.
+
+static bool are_tables_reusable(struct Cover_container *context) {
+	struct jpeg_decompress_struct *decompressor = context->decompressor;
+
+	if (decompressor->progressive_mode || decompressor->arith_code || decompressor->input_scan_number != 1) {
+		return false;
+	}
+
+	jpeg_component_info *component = &decompressor->comp_info[COVER_CONTAINER_COMPONENT_INDEX];
+
+	if (decompressor->num_components > 1 && (
+		component->h_samp_factor != decompressor->max_h_samp_factor ||
+		component->v_samp_factor != decompressor->max_v_samp_factor
+	)) {
+		return false; // Possible, but unusual MCU layout
+	}
+
+	for (int i = 0; i < decompressor->num_components; ++i) {
+		jpeg_component_info *other = &decompressor->comp_info[i];
+
+		if (
+			other->dc_tbl_no < 0 || other->dc_tbl_no >= NUM_HUFF_TBLS ||
+			other->ac_tbl_no < 0 || other->ac_tbl_no >= NUM_HUFF_TBLS ||
+			decompressor->dc_huff_tbl_ptrs[other->dc_tbl_no] == NULL ||
+			decompressor->ac_huff_tbl_ptrs[other->ac_tbl_no] == NULL
+		) {
+			return false;
+		}
+	}
+
+	struct coded_symbols coded = {0};
+
+	mark_coded_symbols(coded.dc, decompressor->dc_huff_tbl_ptrs[component->dc_tbl_no]);
+	mark_coded_symbols(coded.ac, decompressor->ac_huff_tbl_ptrs[component->ac_tbl_no]);
+
+	// Same sizes as the written ones, a single component is written without interleaving
+
+	size_t mcu_width = decompressor->num_components > 1 ? component->h_samp_factor : 1;
+	size_t mcu_height = decompressor->num_components > 1 ? component->v_samp_factor : 1;
+
+	size_t width_in_blocks = (component->width_in_blocks + component->MCU_width - 1) / component->MCU_width * component->MCU_width;
+	size_t height_in_blocks = (component->height_in_blocks + component->MCU_height - 1) / component->MCU_height * component->MCU_height;
+
+	if (width_in_blocks % mcu_width != 0 || height_in_blocks % mcu_height != 0) {
+		return false;
+	}
+
+	size_t restart_interval = decompressor->restart_interval;
+	size_t mcu_index = 0;
+
+	int_fast32_t last_dc = 0;
+
+	for (size_t mcu_y = 0; mcu_y < height_in_blocks; mcu_y += mcu_height) {
+		JBLOCKARRAY rows = decompressor->mem->access_virt_barray(
+			(struct jpeg_common_struct *) decompressor,
+			context->coefficients, mcu_y, mcu_height, false
+		);
+
+		for (size_t mcu_x = 0; mcu_x < width_in_blocks; mcu_x += mcu_width) {
+			if (restart_interval != 0 && mcu_index++ % restart_interval == 0) {
+				last_dc = 0;
+			}
+
+			for (size_t y = 0; y < mcu_height; ++y) {
+				for (size_t x = 0; x < mcu_width; ++x) {
+					if (!is_block_coded(&coded, rows[y][mcu_x + x], &last_dc)) {
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+static void copy_table(struct jpeg_compress_struct *compressor, JHUFF_TBL **destination, const JHUFF_TBL *source) {
+	if (source == NULL) {
+		return;
+	}
+
+	if (*destination == NULL) {
+		*destination = jpeg_alloc_huff_table((struct jpeg_common_struct *) compressor);
+	}
+
+	memcpy((*destination)->bits, source->bits, sizeof source->bits);
+	memcpy((*destination)->huffval, source->huffval, sizeof source->huffval);
+	(*destination)->sent_table = false;
+}
+
+bool Cover_container_write_fast(struct Cover_container *context, struct jpeg_compress_struct *compressor) {
+	struct jpeg_decompress_struct *decompressor = context->decompressor;
+
+	if (!are_tables_reusable(context)) {
+		Cover_container_write(context, compressor);
+
+		return false;
+	}
+
+	jpeg_copy_critical_parameters(decompressor, compressor);
+
+	// DC differences of the other components are coded by the original tables only with the original restarts
+
+	compressor->restart_interval = decompressor->restart_interval;
+
+	for (int i = 0; i < NUM_HUFF_TBLS; ++i) {
+		copy_table(compressor, &compressor->dc_huff_tbl_ptrs[i], decompressor->dc_huff_tbl_ptrs[i]);
+		copy_table(compressor, &compressor->ac_huff_tbl_ptrs[i], decompressor->ac_huff_tbl_ptrs[i]);
+	}
+
+	for (int i = 0; i < decompressor->num_components; ++i) {
+		compressor->comp_info[i].dc_tbl_no = decompressor->comp_info[i].dc_tbl_no;
+		compressor->comp_info[i].ac_tbl_no = decompressor->comp_info[i].ac_tbl_no;
+	}
+
+	compressor->optimize_coding = false;
+
+	write_coefficients(context, compressor);
+
+	return true;
+}
+
+// Unlike LibJPEG's memory destination, which reports its buffer only when the compression finishes, this one puts a new
+// growing buffer to the caller's variable at once, so that it can be freed after a `longjmp`
+
+struct buffer_destination {
+	struct jpeg_destination_mgr manager;
+
+	size_t *length;
+	uint8_t **data;
+
+	uint8_t *buffer;
+	size_t buffer_length;
+	bool allocated;
+};
+
+static void grow_buffer(struct jpeg_compress_struct *compressor, size_t used_length) {
+	struct buffer_destination *destination = (struct buffer_destination *) compressor->dest;
+
+	size_t buffer_length = 4096;
+
+	if (destination->buffer_length > SIZE_MAX / 2) {
+		ERREXIT1(compressor, JERR_OUT_OF_MEMORY, 10);
+	} else if (2 * destination->buffer_length > buffer_length) {
+		buffer_length = 2 * destination->buffer_length;
+	}
+
+	uint8_t *buffer = malloc(buffer_length);
+
+	if (buffer == NULL) {
+		ERREXIT1(compressor, JERR_OUT_OF_MEMORY, 10);
+	}
+
+	if (used_length != 0) {
+		memcpy(buffer, destination->buffer, used_length);
+	}
+
+	if (destination->allocated) {
+		free(destination->buffer);
+	}
+
+	destination->buffer = buffer;
+	destination->buffer_length = buffer_length;
+	destination->allocated = true;
+
+	*destination->data = buffer;
+
+	destination->manager.next_output_byte = buffer + used_length;
+	destination->manager.free_in_buffer = buffer_length - used_length;
+}
+
+static void initialize_buffer_destination(struct jpeg_compress_struct *compressor) {
+	struct buffer_destination *destination = (struct buffer_destination *) compressor->dest;
+
+	destination->manager.next_output_byte = destination->buffer;
+	destination->manager.free_in_buffer = destination->buffer_length;
+
+	if (destination->buffer == NULL || destination->buffer_length == 0) {
+		grow_buffer(compressor, 0);
+	}
+}
+
+// LibJPEG calls it, when the whole buffer is filled, without updating `free_in_buffer`
+
+static boolean empty_buffer_destination(struct jpeg_compress_struct *compressor) {
+	struct buffer_destination *destination = (struct buffer_destination *) compressor->dest;
+
+	grow_buffer(compressor, destination->buffer_length);
+
+	return true;
+}
+
+static void terminate_buffer_destination(struct jpeg_compress_struct *compressor) {
+	struct buffer_destination *destination = (struct buffer_destination *) compressor->dest;
+
+	*destination->length = destination->buffer_length - destination->manager.free_in_buffer;
+}
+
+void Cover_container_write_buffer(
+	struct Cover_container *context,
+	struct jpeg_compress_struct *compressor,
+	size_t *length,
+	uint8_t **data
+) {
+	struct buffer_destination *destination = compressor->mem->alloc_small(
+		(struct jpeg_common_struct *) compressor,
+		JPOOL_PERMANENT,
+		sizeof *destination
+	);
+
+	destination->manager.init_destination = initialize_buffer_destination;
+	destination->manager.empty_output_buffer = empty_buffer_destination;
+	destination->manager.term_destination = terminate_buffer_destination;
+
+	destination->length = length;
+	destination->data = data;
+	destination->buffer = *data;
+	destination->buffer_length = *data == NULL ? 0 : *length;
+	destination->allocated = false;
+
+	compressor->dest = &destination->manager;
+
+	Cover_container_write(context, compressor);
+
+	jpeg_finish_compress(compressor);
+}
+
+void Cover_container_track_changes(struct Cover_container *context) {
+	struct jpeg_decompress_struct *decompressor = context->decompressor;
+	size_t length = context->height_in_blocks / 8 + 1;
+
+	context->changed_rows = decompressor->mem->alloc_large((struct jpeg_common_struct *) decompressor, JPOOL_IMAGE, length);
+
+	memset(context->changed_rows, 0, length);
+}
+
+void Cover_container_mark_changed(struct Cover_container *context, size_t y) {
+	if (context->changed_rows != NULL) {
+		context->changed_rows[y / 8] |= 1 << y % 8;
+	}
+}
+
+// The spliced image is built in a growing buffer, which is kept in the caller's variable, so that it can be freed after a
+// `longjmp`. Bits are written as LibJPEG's Huffman encoder writes them: with stuffed zero bytes after 0xff bytes and with
+// one bits padding before markers.
+
+struct spliced_image {
+	uint8_t **data;
+	size_t length;
+	size_t allocated_length;
+
+	uint_fast32_t bits;
+	int bits_count;
+};
+
+static bool reserve(struct spliced_image *image, size_t length) {
+	if (image->allocated_length - image->length >= length) {
+		return true;
+	}
+
+	if (SIZE_MAX / 2 - image->length < length) {
+		return false;
+	}
+
+	size_t allocated_length = 2 * (image->length + length);
+	uint8_t *data = realloc(*image->data, allocated_length);
+
+	if (data == NULL) {
+		return false;
+	}
+
+	*image->data = data;
+	image->allocated_length = allocated_length;
+
+	return true;
+}
+
+static bool put_bytes(struct spliced_image *image, size_t length, const uint8_t *bytes) {
+	if (!reserve(image, length)) {
+		return false;
+	}
+
+	memcpy(*image->data + image->length, bytes, length);
+	image->length += length;
+
+	return true;
+}
+
+// The space must be reserved, at most 16 bits are put at once
+
+static void put_bits(struct spliced_image *image, uint_fast32_t bits, int count) {
+	image->bits = image->bits << count | (bits & (((uint_fast32_t) 1 << count) - 1));
+	image->bits_count += count;
+
+	for (; image->bits_count >= 8; image->bits_count -= 8) {
+		uint8_t byte = image->bits >> (image->bits_count - 8) & 0xff;
+
+		(*image->data)[image->length++] = byte;
+
+		if (byte == 0xff) {
+			(*image->data)[image->length++] = 0x00;
+		}
+	}
+
+	image->bits &= ((uint_fast32_t) 1 << image->bits_count) - 1;
+}
+
+static void flush_bits(struct spliced_image *image) {
+	if (image->bits_count != 0) {
+		put_bits(image, 0xff, 8 - image->bits_count);
+	}
+}
+
+// A code length of 0 marks a symbol without a code
+
+struct huffman_codes {
+	uint16_t codes[HUFFMAN_SYMBOLS_COUNT];
+	uint8_t lengths[HUFFMAN_SYMBOLS_COUNT];
+};
+
+static bool derive_codes(struct huffman_codes *derived, const JHUFF_TBL *table) {
+	memset(derived->lengths, 0, sizeof derived->lengths);
+
+	uint_fast32_t code = 0;
+	int index = 0;
+
+	for (int length = 1; length <= 16; ++length) {
+		for (int i = 0; i < table->bits[length]; ++i) {
+			if (index == HUFFMAN_SYMBOLS_COUNT || code >= (uint_fast32_t) 1 << length) {
+				return false;
+			}
+
+			derived->codes[table->huffval[index]] = code;
+			derived->lengths[table->huffval[index]] = length;
+
+			++code;
+			++index;
+		}
+
+		code <<= 1;
+	}
+
+	return true;
+}
+
+// The longest block takes 16 + 11 bits for DC and 63 * (16 + 10) bits for AC, twice with stuffed bytes
+
+#define MAXIMUM_BLOCK_LENGTH 512
+
+#define MAXIMUM_DC_CATEGORY 11
+#define MAXIMUM_AC_CATEGORY 10
+
+static bool put_value(struct spliced_image *image, const struct huffman_codes *codes, int symbol, int_fast32_t value, int category) {
+	if (codes->lengths[symbol] == 0) {
+		return false;
+	}
+
+	put_bits(image, codes->codes[symbol], codes->lengths[symbol]);
+
+	if (category != 0) {
+		put_bits(image, value < 0 ? value - 1 : value, category); // Negative values are written in one's complement
+	}
+
+	return true;
+}
+
+static bool encode_block(
+	struct spliced_image *image,
+	const struct huffman_codes *dc_codes,
+	const struct huffman_codes *ac_codes,
+	const JCOEF *block,
+	int_fast32_t *last_dc
+) {
+	if (!reserve(image, MAXIMUM_BLOCK_LENGTH)) {
+		return false;
+	}
+
+	int_fast32_t difference = block[0] - *last_dc;
+	int dc_category = get_category(difference);
+
+	*last_dc = block[0];
+
+	if (dc_category > MAXIMUM_DC_CATEGORY || !put_value(image, dc_codes, dc_category, difference, dc_category)) {
+		return false;
+	}
+
+	int run = 0;
+
+	for (int i = 1; i < COVER_CONTAINER_BLOCK_LENGTH; ++i) {
+		JCOEF value = block[natural_order[i]];
+
+		if (value == 0) {
+			++run;
+
+			continue;
+		}
+
+		for (; run > 15; run -= 16) {
+			if (!put_value(image, ac_codes, 0xf0, 0, 0)) {
+				return false; // ZRL
+			}
+		}
+
+		int ac_category = get_category(value);
+
+		if (ac_category > MAXIMUM_AC_CATEGORY || !put_value(image, ac_codes, run << 4 | ac_category, value, ac_category)) {
+			return false;
+		}
+
+		run = 0;
+	}
+
+	return run == 0 || put_value(image, ac_codes, 0x00, 0, 0); // EOB
+}
+
+struct scan_encoder {
+	struct jpeg_decompress_struct *decompressor;
+	struct jvirt_barray_control **coefficients_arrays;
+
+	struct huffman_codes dc_codes[MAX_COMPS_IN_SCAN];
+	struct huffman_codes ac_codes[MAX_COMPS_IN_SCAN];
+
+	JBLOCKARRAY rows[MAX_COMPS_IN_SCAN];
+	size_t rows_y;
+};
+
+// Encodes MCUs from `start` to `end` as one restart interval, the coding starts and ends on a byte boundary
+
+static bool encode_interval(struct scan_encoder *encoder, struct spliced_image *image, size_t start, size_t end) {
+	struct jpeg_decompress_struct *decompressor = encoder->decompressor;
+
+	int_fast32_t last_dc[MAX_COMPS_IN_SCAN] = {0};
+
+	for (size_t i = start; i < end; ++i) {
+		size_t mcu_x = i % decompressor->MCUs_per_row;
+		size_t mcu_y = i / decompressor->MCUs_per_row;
+
+		for (int c = 0; c < decompressor->comps_in_scan; ++c) {
+			jpeg_component_info *component = decompressor->cur_comp_info[c];
+
+			// Arrays of different components have their own windows, a window stays valid until its array is accessed again
+
+			if (encoder->rows_y != mcu_y) {
+				encoder->rows[c] = decompressor->mem->access_virt_barray(
+					(struct jpeg_common_struct *) decompressor,
+					encoder->coefficients_arrays[component->component_index],
+					mcu_y * component->MCU_height, component->MCU_height, false
+				);
+			}
+
+			for (int y = 0; y < component->MCU_height; ++y) {
+				for (int x = 0; x < component->MCU_width; ++x) {
+					if (!encode_block(
+						image,
+						&encoder->dc_codes[c], &encoder->ac_codes[c],
+						encoder->rows[c][y][mcu_x * component->MCU_width + x],
+						&last_dc[c]
+					)) {
+						return false;
+					}
+				}
+			}
+		}
+
+		encoder->rows_y = mcu_y;
+	}
+
+	flush_bits(image);
+
+	return true;
+}
+
+static bool is_interval_changed(struct Cover_container *context, size_t start, size_t end) {
+	if (context->changed_rows == NULL) {
+		return true;
+	}
+
+	struct jpeg_decompress_struct *decompressor = context->decompressor;
+	int mcu_height = decompressor->comp_info[COVER_CONTAINER_COMPONENT_INDEX].MCU_height;
+
+	size_t first_row = start / decompressor->MCUs_per_row * mcu_height;
+	size_t last_row = (end - 1) / decompressor->MCUs_per_row * mcu_height + mcu_height;
+
+	for (size_t y = first_row; y < last_row && y < context->height_in_blocks; ++y) {
+		if ((context->changed_rows[y / 8] >> y % 8 & 1) == 1) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Finds the segment of the only scan and the entropy-coded data after it
+
+static bool find_scan(size_t length, const uint8_t *original, size_t *scan_start, size_t *data_start) {
+	if (length < 2 || original[0] != 0xff || original[1] != 0xd8) {
+		return false;
+	}
+
+	size_t i = 2;
+
+	while (length - i >= 4) {
+		if (original[i] != 0xff) {
+			return false;
+		}
+
+		if (original[i + 1] == 0xff) {
+			++i; // Fill byte
+
+			continue;
+		}
+
+		size_t segment_length = original[i + 2] << 8 | original[i + 3];
+
+		if (segment_length < 2 || length - i - 2 < segment_length) {
+			return false;
+		}
+
+		if (original[i + 1] == 0xda) {
+			*scan_start = i;
+			*data_start = i + 2 + segment_length;
+
+			return true;
+		}
+
+		i += 2 + segment_length;
+	}
+
+	return false;
+}
+
+// Finds the marker, which ends a restart interval or the scan
+
+static bool find_marker(size_t length, const uint8_t *original, size_t start, size_t *end) {
+	for (size_t i = start; length - i >= 2; ++i) {
+		if (original[i] == 0xff) {
+			if (original[i + 1] != 0x00) {
+				*end = i;
+
+				return true;
+			}
+
+			++i;
+		}
+	}
+
+	return false;
+}
+
+static bool splice(
+	struct Cover_container *context,
+	struct spliced_image *image,
+	size_t original_length,
+	const uint8_t *original
+) {
+	struct jpeg_decompress_struct *decompressor = context->decompressor;
+
+	if (
+		decompressor->progressive_mode ||
+		decompressor->arith_code ||
+		decompressor->input_scan_number != 1 ||
+		decompressor->comps_in_scan != decompressor->num_components
+	) {
+		return false;
+	}
+
+	// The encoder is freed with the decompressor, so it isn't leaked after a `longjmp`
+
+	struct scan_encoder *encoder = decompressor->mem->alloc_large((struct jpeg_common_struct *) decompressor, JPOOL_IMAGE, sizeof *encoder);
+
+	encoder->decompressor = decompressor;
+	encoder->coefficients_arrays = context->coefficients_arrays;
+	encoder->rows_y = SIZE_MAX;
+
+	for (int c = 0; c < decompressor->comps_in_scan; ++c) {
+		jpeg_component_info *component = decompressor->cur_comp_info[c];
+
+		JHUFF_TBL *dc_table = decompressor->dc_huff_tbl_ptrs[component->dc_tbl_no];
+		JHUFF_TBL *ac_table = decompressor->ac_huff_tbl_ptrs[component->ac_tbl_no];
+
+		if (
+			dc_table == NULL || !derive_codes(&encoder->dc_codes[c], dc_table) ||
+			ac_table == NULL || !derive_codes(&encoder->ac_codes[c], ac_table)
+		) {
+			return false;
+		}
+	}
+
+	size_t scan_start;
+	size_t data_start;
+
+	if (!find_scan(original_length, original, &scan_start, &data_start)) {
+		return false;
+	}
+
+	if (!put_bytes(image, scan_start, original)) {
+		return false;
+	}
+
+	size_t mcus_count = (size_t) decompressor->MCUs_per_row * decompressor->MCU_rows_in_scan;
+	size_t restart_interval = decompressor->restart_interval;
+	bool restarts_inserted = restart_interval == 0;
+
+	// A DRI segment before the scan replaces the previous one
+
+	if (restarts_inserted) {
+		restart_interval = decompressor->MCUs_per_row;
+
+		uint8_t segment[] = {0xff, 0xdd, 0x00, 0x04, restart_interval >> 8 & 0xff, restart_interval & 0xff};
+
+		if (!put_bytes(image, sizeof segment, segment)) {
+			return false;
+		}
+	}
+
+	if (!put_bytes(image, data_start - scan_start, original + scan_start)) {
+		return false;
+	}
+
+	size_t position = data_start;
+
+	for (size_t i = 0; i * restart_interval < mcus_count; ++i) {
+		size_t start = i * restart_interval;
+		size_t end = mcus_count - start > restart_interval ? start + restart_interval : mcus_count;
+
+		size_t marker_position = position;
+
+		if (!restarts_inserted && !find_marker(original_length, original, position, &marker_position)) {
+			return false;
+		}
+
+		if (restarts_inserted || is_interval_changed(context, start, end)) {
+			if (!encode_interval(encoder, image, start, end)) {
+				return false;
+			}
+		} else if (!put_bytes(image, marker_position - position, original + position)) {
+			return false;
+		}
+
+		if (end != mcus_count) {
+			uint8_t marker[] = {0xff, JPEG_RST0 + i % 8};
+
+			if (!restarts_inserted) {
+				if (original[marker_position + 1] != marker[1]) {
+					return false;
+				}
+
+				position = marker_position + sizeof marker;
+			}
+
+			if (!put_bytes(image, sizeof marker, marker)) {
+				return false;
+			}
+		} else if (!restarts_inserted && original[marker_position + 1] >= JPEG_RST0 && original[marker_position + 1] < JPEG_RST0 + 8) {
+			return false; // More intervals than MCUs
+		} else {
+			position = marker_position;
+		}
+	}
+
+	// The rest is EOI or other data after the scan
+
+	size_t scan_end;
+
+	if (!find_marker(original_length, original, position, &scan_end) || !put_bytes(image, original_length - scan_end, original + scan_end)) {
+		return false;
+	}
+
+	return true;
+}
+
+bool Cover_container_write_spliced(
+	struct Cover_container *context,
+	size_t original_length,
+	const uint8_t *original,
+	size_t *length,
+	uint8_t **data
+) {
+	*data = NULL;
+
+	struct spliced_image image = {
+		.data = data,
+		.length = 0,
+		.allocated_length = 0,
+		.bits = 0,
+		.bits_count = 0
+	};
+
+	if (!splice(context, &image, original_length, original)) {
+		free(*data);
+
+		*data = NULL;
+
+		return false;
+	}
+
+	*length = image.length;
+
+	return true;
+}
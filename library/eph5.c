@@ -4,13 +4,20 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <pthread.h>
+
 #include <cover/eph5.h>
 #include <cover/container.h>
 #include <jpeglib.h>
 #include <nettle/pbkdf2.h>
 #include <nettle/arcfour.h>
+#include <nettle/sha2.h>
+#include <nettle/hmac.h>
 
 #include "eph5-tables.h"
+#include "bits.h"
+#include "vectors.h"
+#include "workspace.h"
 
 void Cover_Eph5_expand_password(uint8_t *key, const char *password) {
 	size_t length = strlen(password);
@@ -30,12 +37,65 @@ static const size_t reversed_zig_zag[COVER_CONTAINER_BLOCK_LENGTH] = {
 	55, 62, 63
 };
 
-static void decode_coefficients(struct Cover_Eph5 *context) {
-	struct jpeg_decompress_struct *decompressor = context->image->decompressor;
-	struct jvirt_barray_control *coefficients = context->image->coefficients;
+// Bit `c` of each mask corresponds to the AC coefficient `c` of the block in the zig-zag order, bit 0 stays clear.
+//
+// The coefficients are reordered with a scalar gather instead of shuffles. Each vector of the zig-zag order takes its
+// coefficients from up to 8 rows of the natural order, so a shuffle network costs about as many shuffles and blends as
+// there are loads in the gather. The block is in L1 anyway, and SSE2 has no byte shuffles at all.
+
+static void scan_block(const JCOEF *block, uint_fast64_t *payload, uint_fast64_t *usable, uint_fast64_t *one) {
+	#ifdef VECTOR_LENGTH
+		JCOEF zig_zag[COVER_CONTAINER_BLOCK_LENGTH];
+
+		zig_zag[0] = 0;
+
+		for (size_t c = 1; c < COVER_CONTAINER_BLOCK_LENGTH; ++c) {
+			zig_zag[c] = block[reversed_zig_zag[c]];
+		}
+
+		vector zero = vector_set(0);
+		vector plus_one = vector_set(1);
+		vector minus_one = vector_set(-1);
+
+		*payload = 0;
+		*usable = 0;
+		*one = 0;
+
+		for (size_t c = 0; c < COVER_CONTAINER_BLOCK_LENGTH; c += 2 * VECTOR_LENGTH) {
+			vector low = vector_load(zig_zag + c);
+			vector high = vector_load(zig_zag + c + VECTOR_LENGTH);
+
+			// The payload bit is the least significant bit, inverted for negative coefficients
+
+			*payload |= vector_signs(vector_xor(vector_lsb(low), low), vector_xor(vector_lsb(high), high)) << c;
+			*usable |= vector_signs(vector_equal(low, zero), vector_equal(high, zero)) << c;
+
+			*one |= vector_signs(
+				vector_or(vector_equal(low, plus_one), vector_equal(low, minus_one)),
+				vector_or(vector_equal(high, plus_one), vector_equal(high, minus_one))
+			) << c;
+		}
+
+		*usable = ~*usable & ~(uint_fast64_t) 1;
+	#else
+		*payload = 0;
+		*usable = 0;
+		*one = 0;
+
+		for (size_t c = 1; c < COVER_CONTAINER_BLOCK_LENGTH; ++c) {
+			JCOEF coefficient = block[reversed_zig_zag[c]];
+
+			*payload |= (uint_fast64_t) (coefficient % 2 != 0 == coefficient >= 0) << c;
+			*usable |= (uint_fast64_t) (coefficient != 0) << c;
+			*one |= (uint_fast64_t) (coefficient == -1 || coefficient == 1) << c;
+		}
+	#endif
+}
+
+static void decode_row(void *argument, size_t y, JBLOCKROW row) {
+	struct Cover_Eph5 *context = argument;
 
 	size_t width_in_blocks = context->image->width_in_blocks;
-	size_t height_in_blocks = context->image->height_in_blocks;
 
 	size_t usable_count = 0;
 	size_t one_count = 0;
@@ -44,38 +104,77 @@ static void decode_coefficients(struct Cover_Eph5 *context) {
 	uint8_t *usable = context->usable;
 	uint8_t *one = context->one;
 
-	size_t i = 0;
+	size_t i = y * width_in_blocks * COVER_CONTAINER_BLOCK_LENGTH;
 
-	for (JDIMENSION y = 0; y < height_in_blocks; ++y) {
-		JBLOCKARRAY buffer = decompressor->mem->access_virt_barray(
-			(struct jpeg_common_struct *) decompressor,
-			coefficients, y, 1, false
-		);
+	for (size_t x = 0; x < width_in_blocks; ++x) {
+		uint_fast64_t payload_bits;
+		uint_fast64_t usable_bits;
+		uint_fast64_t one_bits;
 
-		for (size_t x = 0; x < width_in_blocks; ++x) {
-			++i;
+		scan_block(row[x], &payload_bits, &usable_bits, &one_bits);
 
-			for (size_t c = 1; c < COVER_CONTAINER_BLOCK_LENGTH; ++c) {
-				JCOEF coefficient = buffer[0][x][reversed_zig_zag[c]]; // Although they were in the right order
+		usable_count += count_bits(usable_bits);
+		one_count += count_bits(one_bits);
 
-				bool payload_bit = coefficient % 2 != 0 == coefficient >= 0;
-				bool is_usable = coefficient != 0;
-				bool is_one = coefficient == -1 || coefficient == 1;
+		store_bits(&payload[i / 8], payload_bits);
+		store_bits(&usable[i / 8], usable_bits);
+		store_bits(&one[i / 8], one_bits);
 
-				usable_count += is_usable;
-				one_count += is_one;
+		i += COVER_CONTAINER_BLOCK_LENGTH;
+	}
 
-				payload[i / 8] |= payload_bit << i % 8;
-				usable[i / 8] |= is_usable << i % 8;
-				one[i / 8] |= is_one << i % 8;
+	context->usable_count += usable_count;
+	context->one_count += one_count;
+}
 
-				++i;
-			}
+static void decode_coefficients(struct Cover_Eph5 *context) {
+	struct Cover_container_visitor visitor = {decode_row, context};
+
+	Cover_container_visit(context->image, &visitor, 1);
+}
+
+// Same as decode_row, but only counts
+
+static void count_row(void *argument, size_t y, JBLOCKROW row) {
+	struct Cover_Eph5 *context = argument;
+
+	size_t width_in_blocks = context->image->width_in_blocks;
+
+	size_t usable_count = 0;
+	size_t one_count = 0;
+
+	for (size_t x = 0; x < width_in_blocks; ++x) {
+		uint_fast64_t payload_bits;
+		uint_fast64_t usable_bits;
+		uint_fast64_t one_bits;
+
+		scan_block(row[x], &payload_bits, &usable_bits, &one_bits);
+
+		usable_count += count_bits(usable_bits);
+		one_count += count_bits(one_bits);
+	}
+
+	context->usable_count += usable_count;
+	context->one_count += one_count;
+}
+
+// Coefficients, which aren't read yet, are only scanned, unless the image is progressive
+
+static void count_coefficients(struct Cover_Eph5 *context) {
+	struct Cover_container_visitor visitor = {count_row, context};
+
+	context->usable_count = 0;
+	context->one_count = 0;
+
+	if (context->image->coefficients == NULL) {
+		if (Cover_container_scan(context->image, count_row, context)) {
+			return;
 		}
+
+		Cover_container_read_coefficients(context->image);
 	}
 
-	context->usable_count = usable_count;
-	context->one_count = one_count;
+	Cover_container_visit(context->image, &visitor, 1);
 }
 
 static void analyze(struct Cover_Eph5 *context) {
@@ -128,139 +227,970 @@ static void analyze(struct Cover_Eph5 *context) {
 
 #define PERMUTATION_BUFFER_LENGTH 8192
 
+#ifdef __GNUC__
+	#define PREFETCH(address, write) __builtin_prefetch(address, write)
+#else
+	#define PREFETCH(address, write)
+#endif
+
+// Swap targets are prefetched this many swaps ahead, hiding random access latency on big images
+
+#define PERMUTATION_PREFETCH_DISTANCE 16
+
 static const uint8_t zero_permutation_buffer[PERMUTATION_BUFFER_LENGTH];
 
+// Applies swaps for a chunk of the RC4 stream, 4 bytes per swap
+
+static void permute_chunk(const uint8_t *buffer, size_t indexes_count, uint32_t *permutation, size_t *last_index) {
+	uint32_t indexes[PERMUTATION_BUFFER_LENGTH / 4];
+
+	// The swap targets don't depend on the swaps, so decode them all first
+
+	for (size_t j = 0; j < indexes_count; ++j) {
+		uint_fast32_t index = (
+			(uint_fast32_t) buffer[4 * j] << 24 |
+			(uint_fast32_t) buffer[4 * j + 1] << 16 |
+			(uint_fast32_t) buffer[4 * j + 2] << 8 |
+			(uint_fast32_t) buffer[4 * j + 3]
+		);
+
+		size_t remaining_count = *last_index - j;
+
+		if ((index >> 31 & 1) == 1) {
+			index = index ^ 0xffffffff;
+			index %= remaining_count;
+			index = remaining_count - 1 - index;
+		} else {
+			index %= remaining_count;
+		}
+
+		indexes[j] = index;
+
+		if (j < PERMUTATION_PREFETCH_DISTANCE) {
+			PREFETCH(&permutation[index], 1);
+		}
+	}
+
+	for (size_t j = 0; j < indexes_count; ++j) {
+		if (j + PERMUTATION_PREFETCH_DISTANCE < indexes_count) {
+			PREFETCH(&permutation[indexes[j + PERMUTATION_PREFETCH_DISTANCE]], 1);
+		}
+
+		--*last_index;
+
+		uint_fast32_t temp = permutation[indexes[j]];
+
+		permutation[indexes[j]] = permutation[*last_index];
+		permutation[*last_index] = temp;
+	}
+}
+
 static void generate_permutation(struct arcfour_ctx *context, size_t count, uint32_t *permutation) {
 	for (size_t i = 0; i < count; ++i) {
 		permutation[i] = i;
 	}
 
 	uint8_t buffer[PERMUTATION_BUFFER_LENGTH];
+
 	size_t last_index = count;
 
 	for (size_t i = 0; i < count; i += PERMUTATION_BUFFER_LENGTH / 4) {
-		size_t buffer_length = PERMUTATION_BUFFER_LENGTH;
+		size_t indexes_count = PERMUTATION_BUFFER_LENGTH / 4;
 
 		if (count - i < PERMUTATION_BUFFER_LENGTH / 4) {
-			buffer_length = (count - i) * 4;
+			indexes_count = count - i;
 		}
 
-		arcfour_crypt(context, buffer_length, buffer, zero_permutation_buffer);
+		arcfour_crypt(context, indexes_count * 4, buffer, zero_permutation_buffer);
 
-		for (size_t j = 0; j < buffer_length; j += 4) {
-			uint_fast32_t index = (
-				(uint_fast32_t) buffer[j] << 24 |
-				(uint_fast32_t) buffer[j + 1] << 16 |
-				(uint_fast32_t) buffer[j + 2] << 8 |
-				(uint_fast32_t) buffer[j + 3]
-			);
+		permute_chunk(buffer, indexes_count, permutation, &last_index);
+	}
+}
 
-			if ((index >> 31 & 1) == 1) {
-				index = index ^ 0xffffffff;
-				index %= last_index;
-				index = last_index - 1 - index;
-			} else {
-				index %= last_index;
-			}
+// RC4 is inherently serial, but the swaps only consume its output. A producer thread fills a ring of chunks for the
+// swapping thread and then continues with the keystream, while the last swaps are still running.
+
+#define PRODUCER_RING_LENGTH 16
+
+struct producer {
+	struct arcfour_ctx *cipher;
+	size_t count;
+
+	size_t keystream_length;
+	uint8_t *keystream;
+
+	uint8_t ring[PRODUCER_RING_LENGTH][PERMUTATION_BUFFER_LENGTH];
+	size_t produced_count;
+	size_t consumed_count;
+
+	pthread_mutex_t mutex;
+	pthread_cond_t produced;
+	pthread_cond_t consumed;
+};
+
+static void *produce(void *argument) {
+	struct producer *producer = argument;
+
+	for (size_t i = 0, c = 0; i < producer->count; i += PERMUTATION_BUFFER_LENGTH / 4, ++c) {
+		size_t indexes_count = PERMUTATION_BUFFER_LENGTH / 4;
+
+		if (producer->count - i < PERMUTATION_BUFFER_LENGTH / 4) {
+			indexes_count = producer->count - i;
+		}
+
+		pthread_mutex_lock(&producer->mutex);
+
+		while (producer->produced_count - producer->consumed_count == PRODUCER_RING_LENGTH) {
+			pthread_cond_wait(&producer->consumed, &producer->mutex);
+		}
+
+		pthread_mutex_unlock(&producer->mutex);
+
+		arcfour_crypt(producer->cipher, indexes_count * 4, producer->ring[c % PRODUCER_RING_LENGTH], zero_permutation_buffer);
+
+		pthread_mutex_lock(&producer->mutex);
+
+		++producer->produced_count;
+
+		pthread_cond_signal(&producer->produced);
+		pthread_mutex_unlock(&producer->mutex);
+	}
 
-			--last_index;
+	// The permutation keeps the cipher state after the permutation, the keystream continues from a copy
 
-			uint_fast32_t temp = permutation[index];
+	struct arcfour_ctx cipher = *producer->cipher;
 
-			permutation[index] = permutation[last_index];
-			permutation[last_index] = temp;
+	arcfour_crypt(&cipher, producer->keystream_length, producer->keystream, producer->keystream);
+
+	return NULL;
+}
+
+static void generate_concurrently(
+	struct arcfour_ctx *context,
+	size_t count,
+	uint32_t *permutation,
+	size_t keystream_length,
+	uint8_t *keystream
+) {
+	struct producer *producer = malloc(sizeof *producer);
+
+	if (producer == NULL) {
+		goto error_producer;
+	}
+
+	producer->cipher = context;
+	producer->count = count;
+	producer->keystream_length = keystream_length;
+	producer->keystream = keystream;
+	producer->produced_count = 0;
+	producer->consumed_count = 0;
+
+	if (pthread_mutex_init(&producer->mutex, NULL) != 0) {
+		goto error_mutex;
+	}
+
+	if (pthread_cond_init(&producer->produced, NULL) != 0) {
+		goto error_produced;
+	}
+
+	if (pthread_cond_init(&producer->consumed, NULL) != 0) {
+		goto error_consumed;
+	}
+
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, produce, producer) != 0) {
+		goto error_thread;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		permutation[i] = i;
+	}
+
+	size_t last_index = count;
+
+	for (size_t i = 0, c = 0; i < count; i += PERMUTATION_BUFFER_LENGTH / 4, ++c) {
+		size_t indexes_count = PERMUTATION_BUFFER_LENGTH / 4;
+
+		if (count - i < PERMUTATION_BUFFER_LENGTH / 4) {
+			indexes_count = count - i;
 		}
+
+		pthread_mutex_lock(&producer->mutex);
+
+		while (producer->produced_count == c) {
+			pthread_cond_wait(&producer->produced, &producer->mutex);
+		}
+
+		pthread_mutex_unlock(&producer->mutex);
+
+		permute_chunk(producer->ring[c % PRODUCER_RING_LENGTH], indexes_count, permutation, &last_index);
+
+		pthread_mutex_lock(&producer->mutex);
+
+		++producer->consumed_count;
+
+		pthread_cond_signal(&producer->consumed);
+		pthread_mutex_unlock(&producer->mutex);
 	}
+
+	pthread_join(thread, NULL);
+
+	pthread_cond_destroy(&producer->consumed);
+	pthread_cond_destroy(&producer->produced);
+	pthread_mutex_destroy(&producer->mutex);
+	free(producer);
+
+	return;
+
+	error_thread: pthread_cond_destroy(&producer->consumed);
+	error_consumed: pthread_cond_destroy(&producer->produced);
+	error_produced: pthread_mutex_destroy(&producer->mutex);
+	error_mutex: free(producer);
+	error_producer: ;
+
+	// Without a thread, the same bytes are generated serially
+
+	generate_permutation(context, count, permutation);
+
+	struct arcfour_ctx cipher = *context;
+
+	arcfour_crypt(&cipher, keystream_length, keystream, keystream);
+}
+
+#define GATHER_PREFETCH_DISTANCE 16
+
+#define PERMUTED_PADDING_LENGTH 8
+
+// Lines up usable coefficients in the permutation order, so that extraction and embedding read them sequentially
+
+static void gather_usable(struct Cover_Eph5 *context) {
+	const uint32_t *permutation = context->permutation;
+	size_t coefficients_count = context->image->coefficients_count;
+
+	const uint8_t *payload = context->payload;
+	const uint8_t *usable = context->usable;
+	const uint8_t *one = context->one;
+
+	uint8_t *permuted_payload = context->permuted_payload;
+	uint8_t *permuted_one = context->permuted_one;
+	uint32_t *permuted_indexes = context->permuted_indexes;
+
+	size_t j = 0;
+
+	for (size_t i = 0; i < coefficients_count; ++i) {
+		if (i + GATHER_PREFETCH_DISTANCE < coefficients_count) {
+			PREFETCH(&usable[permutation[i + GATHER_PREFETCH_DISTANCE] / 8], 0);
+		}
+
+		size_t index = permutation[i];
+
+		if ((usable[index / 8] >> index % 8 & 1) == 0) {
+			continue;
+		}
+
+		permuted_payload[j / 8] |= (payload[index / 8] >> index % 8 & 1) << j % 8;
+
+		if (permuted_one != NULL) {
+			permuted_one[j / 8] |= (one[index / 8] >> index % 8 & 1) << j % 8;
+
+			permuted_indexes[j] = index;
+		}
+
+		++j;
+	}
+}
+
+static void digest_key(uint8_t *digest, const uint8_t *key) {
+	struct sha256_ctx context;
+
+	sha256_init(&context);
+	sha256_update(&context, COVER_EPH5_KEY_LENGTH, key);
+	sha256_digest(&context, SHA256_DIGEST_SIZE, digest);
+}
+
+// Saved permutations are authenticated with a separate key, because the key digest is stored in the header
+
+static const uint8_t permutation_digest_label[] = {'E', 'p', 'h', '5', 'B', 'o', 'd', 'y'};
+
+static void derive_digest_key(uint8_t *digest_key, const uint8_t *key) {
+	struct sha256_ctx context;
+
+	sha256_init(&context);
+	sha256_update(&context, sizeof permutation_digest_label, permutation_digest_label);
+	sha256_update(&context, COVER_EPH5_KEY_LENGTH, key);
+	sha256_digest(&context, SHA256_DIGEST_SIZE, digest_key);
+}
+
+static void digest_permutation(uint8_t *digest, const uint8_t *digest_key, size_t length, const uint8_t *permutation) {
+	struct hmac_sha256_ctx context;
+
+	hmac_sha256_set_key(&context, SHA256_DIGEST_SIZE, digest_key);
+	hmac_sha256_update(&context, length, permutation);
+	hmac_sha256_digest(&context, SHA256_DIGEST_SIZE, digest);
+}
+
+size_t Cover_Eph5_permutation_length(size_t coefficients_count) {
+	if (SIZE_MAX / 4 < coefficients_count) {
+		return 0;
+	}
+
+	return 4 * coefficients_count;
+}
+
+// Allocates a permutation, unless a buffer is provided, and sets up the cipher, but doesn't generate it
+
+static bool prepare_permutation(
+	struct Cover_Eph5_permutation *context,
+	const uint8_t *key,
+	size_t coefficients_count,
+	void *buffer
+) {
+	size_t length = Cover_Eph5_permutation_length(coefficients_count);
+
+	if (length == 0 && coefficients_count != 0) {
+		return false;
+	}
+
+	context->buffer = NULL;
+
+	if (buffer == NULL) {
+		context->buffer = malloc(length == 0 ? 1 : length);
+
+		if (context->buffer == NULL) {
+			return false;
+		}
+
+		buffer = context->buffer;
+	}
+
+	context->coefficients_count = coefficients_count;
+	context->permutation = buffer;
+
+	digest_key(context->key_digest, key);
+	derive_digest_key(context->digest_key, key);
+
+	arcfour_set_key(&context->cipher, COVER_EPH5_KEY_LENGTH, key);
+
+	return true;
+}
+
+bool Cover_Eph5_permutation_initialize(
+	struct Cover_Eph5_permutation *context,
+	const uint8_t *key,
+	size_t coefficients_count
+) {
+	if (!prepare_permutation(context, key, coefficients_count, NULL)) {
+		return false;
+	}
+
+	generate_permutation(&context->cipher, coefficients_count, context->buffer);
+
+	return true;
+}
+
+bool Cover_Eph5_permutation_initialize_buffer(
+	struct Cover_Eph5_permutation *context,
+	const uint8_t *key,
+	size_t coefficients_count,
+	void *buffer
+) {
+	if (!prepare_permutation(context, key, coefficients_count, buffer)) {
+		return false;
+	}
+
+	generate_permutation(&context->cipher, coefficients_count, buffer);
+
+	return true;
+}
+
+static const uint8_t permutation_magic[8] = {'E', 'p', 'h', '5', 'P', 'e', 'r', 'm'};
+
+#define CIPHER_STATE_LENGTH 256
+
+#define PERMUTATION_HEADER_DIGEST_OFFSET 8
+#define PERMUTATION_HEADER_COUNT_OFFSET (PERMUTATION_HEADER_DIGEST_OFFSET + SHA256_DIGEST_SIZE)
+#define PERMUTATION_HEADER_CIPHER_OFFSET (PERMUTATION_HEADER_COUNT_OFFSET + 8)
+#define PERMUTATION_HEADER_PERMUTATION_DIGEST_OFFSET (PERMUTATION_HEADER_CIPHER_OFFSET + CIPHER_STATE_LENGTH + 2)
+#define PERMUTATION_HEADER_BYTE_ORDER_OFFSET (COVER_EPH5_PERMUTATION_HEADER_LENGTH - 4)
+
+static const uint32_t permutation_byte_order = 0x01020304;
+
+void Cover_Eph5_permutation_write_header(const struct Cover_Eph5_permutation *context, uint8_t *header) {
+	memset(header, 0, COVER_EPH5_PERMUTATION_HEADER_LENGTH);
+
+	memcpy(header, permutation_magic, sizeof permutation_magic);
+	memcpy(header + PERMUTATION_HEADER_DIGEST_OFFSET, context->key_digest, SHA256_DIGEST_SIZE);
+
+	for (size_t i = 0; i < 8; ++i) {
+		header[PERMUTATION_HEADER_COUNT_OFFSET + i] = (uint_fast64_t) context->coefficients_count >> 8 * i & 0xff;
+	}
+
+	memcpy(header + PERMUTATION_HEADER_CIPHER_OFFSET, context->cipher.S, CIPHER_STATE_LENGTH);
+	header[PERMUTATION_HEADER_CIPHER_OFFSET + CIPHER_STATE_LENGTH] = context->cipher.i;
+	header[PERMUTATION_HEADER_CIPHER_OFFSET + CIPHER_STATE_LENGTH + 1] = context->cipher.j;
+
+	digest_permutation(
+		header + PERMUTATION_HEADER_PERMUTATION_DIGEST_OFFSET,
+		context->digest_key,
+		4 * context->coefficients_count,
+		(const uint8_t *) context->permutation
+	);
+
+	memcpy(header + PERMUTATION_HEADER_BYTE_ORDER_OFFSET, &permutation_byte_order, 4);
+}
+
+bool Cover_Eph5_permutation_load(
+	struct Cover_Eph5_permutation *context,
+	const uint8_t *key,
+	size_t coefficients_count,
+	size_t length,
+	const uint8_t *data
+) {
+	size_t permutation_length = Cover_Eph5_permutation_length(coefficients_count);
+
+	if (
+		permutation_length == 0 && coefficients_count != 0 ||
+		length < COVER_EPH5_PERMUTATION_HEADER_LENGTH ||
+		length - COVER_EPH5_PERMUTATION_HEADER_LENGTH != permutation_length
+	) {
+		return false;
+	}
+
+	uint_fast64_t count = 0;
+
+	for (size_t i = 0; i < 8; ++i) {
+		count |= (uint_fast64_t) data[PERMUTATION_HEADER_COUNT_OFFSET + i] << 8 * i;
+	}
+
+	uint8_t key_digest[SHA256_DIGEST_SIZE];
+
+	digest_key(key_digest, key);
+
+	if (
+		memcmp(data, permutation_magic, sizeof permutation_magic) != 0 ||
+		memcmp(data + PERMUTATION_HEADER_DIGEST_OFFSET, key_digest, SHA256_DIGEST_SIZE) != 0 ||
+		count != coefficients_count ||
+		memcmp(data + PERMUTATION_HEADER_BYTE_ORDER_OFFSET, &permutation_byte_order, 4) != 0
+	) {
+		return false;
+	}
+
+	// Indexes of a damaged permutation could point outside of the bit arrays
+
+	uint8_t digest_key[SHA256_DIGEST_SIZE];
+	uint8_t permutation_digest[SHA256_DIGEST_SIZE];
+
+	derive_digest_key(digest_key, key);
+	digest_permutation(permutation_digest, digest_key, permutation_length, data + COVER_EPH5_PERMUTATION_HEADER_LENGTH);
+
+	if (memcmp(data + PERMUTATION_HEADER_PERMUTATION_DIGEST_OFFSET, permutation_digest, SHA256_DIGEST_SIZE) != 0) {
+		return false;
+	}
+
+	context->buffer = NULL;
+	context->coefficients_count = coefficients_count;
+	context->permutation = (const uint32_t *) (data + COVER_EPH5_PERMUTATION_HEADER_LENGTH);
+
+	memcpy(context->key_digest, key_digest, SHA256_DIGEST_SIZE);
+	memcpy(context->digest_key, digest_key, SHA256_DIGEST_SIZE);
+
+	memcpy(context->cipher.S, data + PERMUTATION_HEADER_CIPHER_OFFSET, CIPHER_STATE_LENGTH);
+	context->cipher.i = data[PERMUTATION_HEADER_CIPHER_OFFSET + CIPHER_STATE_LENGTH];
+	context->cipher.j = data[PERMUTATION_HEADER_CIPHER_OFFSET + CIPHER_STATE_LENGTH + 1];
+
+	return true;
+}
+
+void Cover_Eph5_permutation_destroy(struct Cover_Eph5_permutation *context) {
+	free(context->buffer);
+}
+
+// Generates the keystream and gathers the usable coefficients for decoded bit arrays
+
+static bool initialize_permuted(struct Cover_Eph5 *context, const struct Cover_Eph5_permutation *permutation, bool writable) {
+	context->permutation = permutation->permutation;
+
+	if (context->keystream == NULL) {
+		context->keystream = workspace_allocate(&context->workspace, context->usable_count / 8, true);
+
+		if (context->keystream == NULL) {
+			goto error_keystream;
+		}
+
+		struct arcfour_ctx cipher = permutation->cipher;
+
+		arcfour_crypt(&cipher, context->usable_count / 8, context->keystream, context->keystream);
+	}
+
+	// The padding lets the embedding load whole words of bits near the end
+
+	size_t permuted_length = context->usable_count / 8 + 1 + PERMUTED_PADDING_LENGTH;
+
+	context->permuted_payload = workspace_allocate(&context->workspace, permuted_length, true);
+
+	if (context->permuted_payload == NULL) {
+		goto error_permuted_payload;
+	}
+
+	if (writable) {
+		context->permuted_one = workspace_allocate(&context->workspace, permuted_length, true);
+
+		if (context->permuted_one == NULL) {
+			goto error_permuted_one;
+		}
+
+		context->permuted_indexes = workspace_allocate(&context->workspace, 4 * context->usable_count, false);
+
+		if (context->permuted_indexes == NULL) {
+			goto error_permuted_indexes;
+		}
+	}
+
+	// Extraction-only contexts gather lazily, bounded extraction doesn't need it
+
+	context->gathered = writable;
+
+	if (writable) {
+		gather_usable(context);
+	}
+
+	return true;
+
+	error_permuted_indexes: workspace_free(context->workspace, context->permuted_one);
+	error_permuted_one: workspace_free(context->workspace, context->permuted_payload);
+	error_permuted_payload: workspace_free(context->workspace, context->keystream);
+	error_keystream: ;
+
+	context->keystream = NULL;
+	context->permuted_payload = NULL;
+	context->permuted_one = NULL;
+
+	return false;
+}
+
+// Allocates the bit arrays, which are then filled by decode_row
+
+static bool allocate_bit_arrays(struct Cover_Eph5 *context, struct Cover_container *image, bool writable) {
+	context->image = image;
+
+	context->bit_array_length = image->coefficients_count / 8;
+
+	context->payload = workspace_allocate(&context->workspace, context->bit_array_length, true);
+
+	if (context->payload == NULL) {
+		goto error_payload;
+	}
+
+	context->usable = workspace_allocate(&context->workspace, context->bit_array_length, true);
+
+	if (context->usable == NULL) {
+		goto error_usable;
+	}
+
+	context->one = workspace_allocate(&context->workspace, context->bit_array_length, true);
+
+	if (context->one == NULL) {
+		goto error_one;
+	}
+
+	context->changes = NULL;
+
+	if (writable) {
+		context->changes = workspace_allocate(&context->workspace, context->bit_array_length, false);
+
+		if (context->changes == NULL) {
+			goto error_changes;
+		}
+	}
+
+	context->keystream = NULL;
+	context->permuted_payload = NULL;
+	context->permuted_one = NULL;
+	context->permuted_indexes = NULL;
+	context->bit_arrays_owned = true;
+
+	context->usable_count = 0;
+	context->one_count = 0;
+
+	return true;
+
+	error_changes: workspace_free(context->workspace, context->one);
+	error_one: workspace_free(context->workspace, context->usable);
+	error_usable: workspace_free(context->workspace, context->payload);
+	error_payload: ;
+
+	return false;
+}
+
+// Finishes the initialization after decoding, frees the bit arrays on failure
+
+static bool complete(struct Cover_Eph5 *context, const struct Cover_Eph5_permutation *permutation, bool concurrently) {
+	analyze(context);
+
+	// The own permutation isn't generated yet, it's generated along with the keystream
+
+	if (concurrently) {
+		context->keystream = workspace_allocate(&context->workspace, context->usable_count / 8, true);
+
+		if (context->keystream == NULL) {
+			goto error_permuted;
+		}
+
+		generate_concurrently(
+			&context->own_permutation.cipher,
+			context->image->coefficients_count, context->own_permutation.buffer,
+			context->usable_count / 8, context->keystream
+		);
+	}
+
+	if (!initialize_permuted(context, permutation, context->changes != NULL)) {
+		goto error_permuted;
+	}
+
+	return true;
+
+	error_permuted: workspace_free(context->workspace, context->changes);
+	workspace_free(context->workspace, context->one);
+	workspace_free(context->workspace, context->usable);
+	workspace_free(context->workspace, context->payload);
+
+	return false;
+}
+
+static bool initialize(
+	struct Cover_Eph5 *context,
+	struct Cover_container *image,
+	const struct Cover_Eph5_permutation *permutation,
+	bool writable,
+	bool concurrently
+) {
+	if (!allocate_bit_arrays(context, image, writable)) {
+		return false;
+	}
+
+	decode_coefficients(context);
+
+	return complete(context, permutation, concurrently);
+}
+
+bool Cover_Eph5_initialize_with_permutation(
+	struct Cover_Eph5 *context,
+	struct Cover_container *image,
+	const struct Cover_Eph5_permutation *permutation,
+	bool writable
+) {
+	if (permutation->coefficients_count != image->coefficients_count) {
+		return false;
+	}
+
+	context->permutation_owned = false;
+	context->workspace = NULL;
+
+	return initialize(context, image, permutation, writable, false);
+}
+
+bool Cover_Eph5_initialize_deferred(
+	struct Cover_Eph5 *context,
+	struct Cover_container *image,
+	const struct Cover_Eph5_permutation *permutation,
+	bool writable,
+	struct Cover_container_visitor *visitor
+) {
+	if (permutation->coefficients_count != image->coefficients_count) {
+		return false;
+	}
+
+	context->permutation_owned = false;
+	context->workspace = NULL;
+
+	if (!allocate_bit_arrays(context, image, writable)) {
+		return false;
+	}
+
+	context->deferred_permutation = permutation;
+
+	visitor->visit = decode_row;
+	visitor->argument = context;
+
+	return true;
+}
+
+bool Cover_Eph5_complete_deferred(struct Cover_Eph5 *context) {
+	return complete(context, context->deferred_permutation, false);
+}
+
+bool Cover_Eph5_initialize(
+	struct Cover_Eph5 *context,
+	struct Cover_container *image,
+	const uint8_t *key,
+	bool writable
+) {
+	if (!Cover_Eph5_permutation_initialize(&context->own_permutation, key, image->coefficients_count)) {
+		return false;
+	}
+
+	context->permutation_owned = true;
+	context->workspace = NULL;
+
+	if (!initialize(context, image, &context->own_permutation, writable, false)) {
+		Cover_Eph5_permutation_destroy(&context->own_permutation);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool Cover_Eph5_initialize_concurrently(
+	struct Cover_Eph5 *context,
+	struct Cover_container *image,
+	const uint8_t *key,
+	bool writable
+) {
+	context->workspace = NULL;
+
+	if (!prepare_permutation(&context->own_permutation, key, image->coefficients_count, NULL)) {
+		return false;
+	}
+
+	context->permutation_owned = true;
+
+	if (!initialize(context, image, &context->own_permutation, writable, true)) {
+		Cover_Eph5_permutation_destroy(&context->own_permutation);
+
+		return false;
+	}
+
+	return true;
 }
 
-bool Cover_Eph5_initialize(
+bool Cover_Eph5_initialize_streaming(
 	struct Cover_Eph5 *context,
 	struct Cover_container *image,
-	const uint8_t *key,
-	bool writable
+	const struct Cover_Eph5_permutation *permutation
 ) {
-	context->image = image;
+	if (permutation->coefficients_count != image->coefficients_count) {
+		return false;
+	}
 
+	context->image = image;
 	context->bit_array_length = image->coefficients_count / 8;
 
-	context->payload = calloc(context->bit_array_length == 0 ? 1 : context->bit_array_length, 1);
+	context->payload = NULL;
+	context->usable = NULL;
+	context->one = NULL;
+	context->permutation = NULL;
+	context->keystream = NULL;
+	context->permuted_payload = NULL;
+	context->permuted_one = NULL;
+	context->permuted_indexes = NULL;
+	context->gathered = false;
+	context->permutation_owned = false;
+	context->bit_arrays_owned = true;
+	context->changes = NULL;
+	context->workspace = NULL;
 
-	if (context->payload == NULL) {
-		goto error_payload;
+	if (image->decompressor->progressive_mode) {
+		Cover_container_read_coefficients(image);
+
+		return Cover_Eph5_initialize_with_permutation(context, image, permutation, false);
 	}
 
+	context->payload = calloc(context->bit_array_length == 0 ? 1 : context->bit_array_length, 1);
 	context->usable = calloc(context->bit_array_length == 0 ? 1 : context->bit_array_length, 1);
+	context->one = calloc(context->bit_array_length == 0 ? 1 : context->bit_array_length, 1);
 
-	if (context->usable == NULL) {
-		goto error_usable;
+	if (context->payload == NULL || context->usable == NULL || context->one == NULL) {
+		goto error_bit_arrays;
 	}
 
-	context->one = calloc(context->bit_array_length == 0 ? 1 : context->bit_array_length, 1);
+	context->usable_count = 0;
+	context->one_count = 0;
 
-	if (context->one == NULL) {
-		goto error_one;
+	Cover_container_scan(image, decode_row, context);
+
+	analyze(context);
+
+	if (!initialize_permuted(context, permutation, false)) {
+		goto error_bit_arrays;
 	}
 
-	context->changes = NULL;
+	return true;
 
-	if (writable) {
-		context->changes = malloc(context->bit_array_length == 0 ? 1 : context->bit_array_length);
+	error_bit_arrays: free(context->one);
+	free(context->usable);
+	free(context->payload);
 
-		if (context->changes == NULL) {
-			goto error_changes;
-		}
+	context->payload = NULL;
+	context->usable = NULL;
+	context->one = NULL;
+
+	return false;
+}
+
+bool Cover_Eph5_initialize_decoded(struct Cover_Eph5 *context, struct Cover_container *image) {
+	// The context can be destroyed after a `longjmp` from LibJPEG
+
+	context->payload = NULL;
+	context->usable = NULL;
+	context->one = NULL;
+	context->changes = NULL;
+	context->permutation = NULL;
+	context->keystream = NULL;
+	context->permuted_payload = NULL;
+	context->permuted_one = NULL;
+	context->permuted_indexes = NULL;
+	context->gathered = false;
+	context->permutation_owned = false;
+	context->bit_arrays_owned = true;
+	context->workspace = NULL;
+
+	if (!allocate_bit_arrays(context, image, false)) {
+		context->payload = NULL;
+		context->usable = NULL;
+		context->one = NULL;
+
+		return false;
 	}
 
-	if (SIZE_MAX / 4 < image->coefficients_count) {
-		goto error_permutation;
+	if (!Cover_container_scan(image, decode_row, context)) {
+		Cover_container_read_coefficients(image);
+
+		decode_coefficients(context);
 	}
 
-	context->permutation = malloc(4 * (image->coefficients_count == 0 ? 1 : image->coefficients_count));
+	analyze(context);
+
+	return true;
+}
 
-	if (context->permutation == NULL) {
-		goto error_permutation;
+bool Cover_Eph5_initialize_shared(
+	struct Cover_Eph5 *context,
+	const struct Cover_Eph5 *source,
+	const struct Cover_Eph5_permutation *permutation
+) {
+	if (permutation->coefficients_count != source->image->coefficients_count) {
+		return false;
 	}
 
+	*context = *source;
+
+	context->changes = NULL;
 	context->keystream = NULL;
+	context->permuted_payload = NULL;
+	context->permuted_one = NULL;
+	context->permuted_indexes = NULL;
+	context->bit_arrays_owned = false;
+	context->permutation_owned = false;
+	context->workspace = NULL;
+
+	return initialize_permuted(context, permutation, false);
+}
 
-	decode_coefficients(context);
+void Cover_Eph5_analyze(struct Cover_Eph5 *context, struct Cover_container *image) {
+	context->image = image;
+	context->bit_array_length = 0;
+
+	context->payload = NULL;
+	context->usable = NULL;
+	context->one = NULL;
+	context->permutation = NULL;
+	context->keystream = NULL;
+	context->permuted_payload = NULL;
+	context->permuted_one = NULL;
+	context->permuted_indexes = NULL;
+	context->gathered = false;
+	context->permutation_owned = false;
+	context->bit_arrays_owned = false;
+	context->changes = NULL;
+	context->workspace = NULL;
+
+	count_coefficients(context);
 
 	analyze(context);
+}
 
-	context->keystream = calloc(context->usable_count == 0 ? 1 : context->usable_count / 8, 1);
+size_t Cover_Eph5_workspace_size(const struct Cover_container *image, bool writable) {
+	size_t coefficients_count = image->coefficients_count;
+	size_t bit_array_length = coefficients_count / 8;
+	size_t permutation_length = Cover_Eph5_permutation_length(coefficients_count);
 
-	if (context->keystream == NULL) {
-		goto error_keystream;
+	if (permutation_length == 0 && coefficients_count != 0) {
+		return 0;
 	}
 
-	struct arcfour_ctx cipher;
+	// The arrays, which depend on the usable coefficients count, are reserved for all coefficients
 
-	arcfour_set_key(&cipher, COVER_EPH5_KEY_LENGTH, key);
+	size_t size = 0;
 
-	generate_permutation(&cipher, image->coefficients_count, context->permutation);
+	bool fits = (
+		workspace_add(&size, permutation_length) &&
+		workspace_add(&size, bit_array_length) &&
+		workspace_add(&size, bit_array_length) &&
+		workspace_add(&size, bit_array_length) &&
+		workspace_add(&size, bit_array_length) &&
+		workspace_add(&size, bit_array_length + 1 + PERMUTED_PADDING_LENGTH)
+	);
 
-	arcfour_crypt(&cipher, context->usable_count / 8, context->keystream, context->keystream);
+	if (writable) {
+		fits = (
+			fits &&
+			workspace_add(&size, bit_array_length) &&
+			workspace_add(&size, bit_array_length + 1 + PERMUTED_PADDING_LENGTH) &&
+			workspace_add(&size, permutation_length)
+		);
+	}
 
-	return true;
+	return fits ? size : 0;
+}
 
-	free(context->keystream);
-	error_keystream: free(context->permutation);
-	error_permutation: free(context->changes);
-	error_changes: free(context->one);
-	error_one: free(context->usable);
-	error_usable: free(context->payload);
-	error_payload: ;
+bool Cover_Eph5_initialize_workspace(
+	struct Cover_Eph5 *context,
+	struct Cover_container *image,
+	const uint8_t *key,
+	bool writable,
+	void *workspace
+) {
+	size_t permutation_length = Cover_Eph5_permutation_length(image->coefficients_count);
 
-	return false;
+	if (permutation_length == 0 && image->coefficients_count != 0) {
+		return false;
+	}
+
+	context->workspace = workspace;
+
+	void *buffer = workspace_allocate(&context->workspace, permutation_length, false);
+
+	if (!Cover_Eph5_permutation_initialize_buffer(&context->own_permutation, key, image->coefficients_count, buffer)) {
+		return false;
+	}
+
+	context->permutation_owned = true;
+
+	return initialize(context, image, &context->own_permutation, writable, false);
 }
 
 void Cover_Eph5_destroy(struct Cover_Eph5 *context) {
+	if (context->workspace != NULL) {
+		return; // All arrays are in the caller's workspace
+	}
+
+	free(context->permuted_indexes);
+	free(context->permuted_one);
+	free(context->permuted_payload);
 	free(context->keystream);
-	free(context->permutation);
 	free(context->changes);
-	free(context->one);
-	free(context->usable);
-	free(context->payload);
+
+	if (context->bit_arrays_owned) {
+		free(context->one);
+		free(context->usable);
+		free(context->payload);
+	}
+
+	if (context->permutation_owned) {
+		Cover_Eph5_permutation_destroy(&context->own_permutation);
+	}
 }
 
 size_t Cover_Eph5_apply(struct Cover_Eph5 *context, size_t *zeroed_count) {
@@ -283,6 +1213,8 @@ size_t Cover_Eph5_apply(struct Cover_Eph5 *context, size_t *zeroed_count) {
 			coefficients, y, 1, true
 		);
 
+		size_t row_changed_count = changed_count;
+
 		for (size_t x = 0; x < width_in_blocks; ++x) {
 			++i;
 
@@ -304,15 +1236,29 @@ size_t Cover_Eph5_apply(struct Cover_Eph5 *context, size_t *zeroed_count) {
 				++i;
 			}
 		}
+
+		if (changed_count != row_changed_count) {
+			Cover_container_mark_changed(context->image, y);
+		}
 	}
 
 	return changed_count;
 }
 
 void Cover_Eph5_extract(struct Cover_Eph5 *context, uint8_t **data) {
-	size_t extracted_length = 0;
-	int byte = 0;
-	int bit_position = 0;
+	if (!context->gathered) {
+		gather_usable(context);
+
+		context->gathered = true;
+	}
+
+	const uint8_t *permuted_payload = context->permuted_payload;
+
+	// For k = 1, the permuted payload bits are the data bits themselves
+
+	for (size_t i = 0; i < context->extractable_length[0]; ++i) {
+		data[0][i] = permuted_payload[i] ^ context->keystream[i];
+	}
 
 	size_t extracted_lengths[COVER_EPH5_MAXIMUM_K - 1] = {0};
 	int bytes[COVER_EPH5_MAXIMUM_K - 1] = {0};
@@ -320,41 +1266,101 @@ void Cover_Eph5_extract(struct Cover_Eph5 *context, uint8_t **data) {
 	int bits[COVER_EPH5_MAXIMUM_K - 1] = {0};
 	int bit_masks[COVER_EPH5_MAXIMUM_K - 1] = {0};
 
-	for (size_t i = 0; i < context->image->coefficients_count; ++i) {
-		size_t index = context->permutation[i];
+	for (size_t i = 0; i < context->usable_count; ++i) {
+		int payload_bit = permuted_payload[i / 8] >> i % 8 & 1;
 
-		if ((context->usable[index / 8] >> index % 8 & 1) == 0) {
-			continue;
+		for (size_t j = 0; j < COVER_EPH5_MAXIMUM_K - 1; ++j) {
+			++bit_masks[j];
+
+			if (payload_bit == 1) {
+				bits[j] ^= bit_masks[j];
+			}
+
+			if (bit_masks[j] == (4 << j) - 1) {
+				bytes[j] |= bits[j] << bit_positions[j];
+				bit_positions[j] += j + 2;
+
+				if (bit_positions[j] >= 8) {
+					data[j + 1][extracted_lengths[j]] = bytes[j] & 0xff ^ context->keystream[extracted_lengths[j]];
+					bytes[j] >>= 8;
+					bit_positions[j] -= 8;
+					++extracted_lengths[j];
+				}
+
+				bits[j] = 0;
+				bit_masks[j] = 0;
+			}
 		}
+	}
+}
+
+#define STREAM_CHUNK_LENGTH 1024
+
+bool Cover_Eph5_extract_stream(
+	struct Cover_Eph5 *context,
+	bool (*write)(void *argument, int k, size_t length, const uint8_t *data),
+	void *argument
+) {
+	if (!context->gathered) {
+		gather_usable(context);
 
-		int payload_bit = context->payload[index / 8] >> index % 8 & 1;
+		context->gathered = true;
+	}
+
+	const uint8_t *permuted_payload = context->permuted_payload;
 
-		byte |= payload_bit << bit_position;
-		++bit_position;
+	uint8_t chunks[COVER_EPH5_MAXIMUM_K][STREAM_CHUNK_LENGTH];
 
-		if (bit_position == 8) {
-			data[0][extracted_length] = byte ^ context->keystream[extracted_length];
-			byte = 0;
-			bit_position = 0;
-			++extracted_length;
+	for (size_t i = 0; i < context->extractable_length[0]; i += STREAM_CHUNK_LENGTH) {
+		size_t length = context->extractable_length[0] - i;
+
+		if (length > STREAM_CHUNK_LENGTH) {
+			length = STREAM_CHUNK_LENGTH;
 		}
 
-		for (size_t j = 0; j < COVER_EPH5_MAXIMUM_K - 1; ++j) {
+		for (size_t j = 0; j < length; ++j) {
+			chunks[0][j] = permuted_payload[i + j] ^ context->keystream[i + j];
+		}
+
+		if (!write(argument, 1, length, chunks[0])) {
+			return false;
+		}
+	}
+
+	size_t chunk_lengths[COVER_EPH5_MAXIMUM_K] = {0};
+	size_t extracted_lengths[COVER_EPH5_MAXIMUM_K] = {0};
+	int bytes[COVER_EPH5_MAXIMUM_K] = {0};
+	int bit_positions[COVER_EPH5_MAXIMUM_K] = {0};
+	int bits[COVER_EPH5_MAXIMUM_K] = {0};
+	int bit_masks[COVER_EPH5_MAXIMUM_K] = {0};
+
+	for (size_t i = 0; i < context->usable_count; ++i) {
+		int payload_bit = permuted_payload[i / 8] >> i % 8 & 1;
+
+		for (size_t j = 1; j < COVER_EPH5_MAXIMUM_K; ++j) {
 			++bit_masks[j];
 
 			if (payload_bit == 1) {
 				bits[j] ^= bit_masks[j];
 			}
 
-			if (bit_masks[j] == (4 << j) - 1) {
+			if (bit_masks[j] == (2 << j) - 1) {
 				bytes[j] |= bits[j] << bit_positions[j];
-				bit_positions[j] += j + 2;
+				bit_positions[j] += j + 1;
 
 				if (bit_positions[j] >= 8) {
-					data[j + 1][extracted_lengths[j]] = bytes[j] & 0xff ^ context->keystream[extracted_lengths[j]];
+					chunks[j][chunk_lengths[j]] = bytes[j] & 0xff ^ context->keystream[extracted_lengths[j]];
 					bytes[j] >>= 8;
 					bit_positions[j] -= 8;
 					++extracted_lengths[j];
+
+					if (++chunk_lengths[j] == STREAM_CHUNK_LENGTH) {
+						if (!write(argument, j + 1, STREAM_CHUNK_LENGTH, chunks[j])) {
+							return false;
+						}
+
+						chunk_lengths[j] = 0;
+					}
 				}
 
 				bits[j] = 0;
@@ -362,14 +1368,151 @@ void Cover_Eph5_extract(struct Cover_Eph5 *context, uint8_t **data) {
 			}
 		}
 	}
+
+	for (size_t j = 1; j < COVER_EPH5_MAXIMUM_K; ++j) {
+		if (chunk_lengths[j] != 0 && !write(argument, j + 1, chunk_lengths[j], chunks[j])) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
-size_t Cover_Eph5_embed(struct Cover_Eph5 *context, size_t length, const uint8_t *data, int k) {
+void Cover_Eph5_extract_bounded(struct Cover_Eph5 *context, const size_t *lengths, uint8_t **data) {
+	const uint32_t *permutation = context->permutation;
+	size_t coefficients_count = context->image->coefficients_count;
+
+	const uint8_t *payload = context->payload;
+	const uint8_t *usable = context->usable;
+
+	size_t remaining_count = 0;
+
+	for (size_t j = 0; j < COVER_EPH5_MAXIMUM_K; ++j) {
+		remaining_count += lengths[j] != 0;
+	}
+
+	size_t extracted_lengths[COVER_EPH5_MAXIMUM_K] = {0};
+	int bytes[COVER_EPH5_MAXIMUM_K] = {0};
+	int bit_positions[COVER_EPH5_MAXIMUM_K] = {0};
+	int bits[COVER_EPH5_MAXIMUM_K] = {0};
+	int bit_masks[COVER_EPH5_MAXIMUM_K] = {0};
+
+	for (size_t i = 0; remaining_count != 0 && i < coefficients_count; ++i) {
+		if (i + GATHER_PREFETCH_DISTANCE < coefficients_count) {
+			PREFETCH(&usable[permutation[i + GATHER_PREFETCH_DISTANCE] / 8], 0);
+		}
+
+		size_t index = permutation[i];
+
+		if ((usable[index / 8] >> index % 8 & 1) == 0) {
+			continue;
+		}
+
+		int payload_bit = payload[index / 8] >> index % 8 & 1;
+
+		for (size_t j = 0; j < COVER_EPH5_MAXIMUM_K; ++j) {
+			if (extracted_lengths[j] == lengths[j]) {
+				continue;
+			}
+
+			++bit_masks[j];
+
+			if (payload_bit == 1) {
+				bits[j] ^= bit_masks[j];
+			}
+
+			if (bit_masks[j] == (2 << j) - 1) {
+				bytes[j] |= bits[j] << bit_positions[j];
+				bit_positions[j] += j + 1;
+
+				if (bit_positions[j] >= 8) {
+					data[j][extracted_lengths[j]] = bytes[j] & 0xff ^ context->keystream[extracted_lengths[j]];
+					bytes[j] >>= 8;
+					bit_positions[j] -= 8;
+					++extracted_lengths[j];
+
+					remaining_count -= extracted_lengths[j] == lengths[j];
+				}
+
+				bits[j] = 0;
+				bit_masks[j] = 0;
+			}
+		}
+	}
+}
+
+// Bit `t` of a position is set for positions in the mask `t`
+
+static const uint_fast64_t position_masks[6] = {
+	0xaaaaaaaaaaaaaaaa, 0xcccccccccccccccc, 0xf0f0f0f0f0f0f0f0,
+	0xff00ff00ff00ff00, 0xffff0000ffff0000, 0xffffffff00000000
+};
+
+// XOR of positions of set bits
+
+static int word_syndrome(uint_fast64_t bits) {
+	int result = 0;
+
+	for (int t = 0; t < 6; ++t) {
+		result |= (count_bits(bits & position_masks[t]) & 1) << t;
+	}
+
+	return result;
+}
+
+// Hamming syndrome of a group of up to 127 bits, the bit `q` has the position `q + 1`
+
+static int group_syndrome(const uint_fast64_t *group) {
+	uint_fast64_t low = group[0] << 1;
+	uint_fast64_t high = group[1] << 1 | group[0] >> 63;
+
+	if (high == 0) {
+		return word_syndrome(low);
+	}
+
+	return word_syndrome(low) ^ word_syndrome(high) ^ (count_bits(high) & 1) << 6;
+}
+
+static void remove_group_bit(uint_fast64_t *group, int q) {
+	if (q < 64) {
+		uint_fast64_t low_mask = ((uint_fast64_t) 1 << q) - 1;
+
+		group[0] = group[0] & low_mask | group[0] >> 1 & ~low_mask | group[1] << 63;
+		group[1] >>= 1;
+	} else {
+		uint_fast64_t low_mask = ((uint_fast64_t) 1 << (q - 64)) - 1;
+
+		group[1] = group[1] & low_mask | group[1] >> 1 & ~low_mask;
+	}
+}
+
+// Group members are usable coefficients from `start`, except the removed ones, sorted ascending
+
+#define REMOVED_INDEXES_CAPACITY 16
+
+static size_t member_index(size_t start, const size_t *removed_indexes, int removed_count, int q) {
+	size_t index = start + q;
+
+	for (int i = 0; i < removed_count && removed_indexes[i] <= index; ++i) {
+		++index;
+	}
+
+	return index;
+}
+
+// With `whole`, the embedding with k > 1 stops as soon as the remaining groups can't fit, the result is meaningful only
+// if it's the whole length
+
+static size_t embed(struct Cover_Eph5 *context, size_t length, const uint8_t *data, int k, bool whole) {
 	memset(context->changes, 0, context->bit_array_length);
 
+	const uint8_t *permuted_payload = context->permuted_payload;
+	const uint8_t *permuted_one = context->permuted_one;
+	const uint32_t *permuted_indexes = context->permuted_indexes;
+
 	size_t embedded_length = 0;
 
-	size_t coefficient_index = 0;
+	size_t usable_index = 0;
 
 	if (k == 1) {
 		for (; embedded_length < length; ++embedded_length) {
@@ -381,22 +1524,22 @@ size_t Cover_Eph5_embed(struct Cover_Eph5 *context, size_t length, const uint8_t
 				bool keep = true;
 
 				while (keep) {
-					if (coefficient_index == context->image->coefficients_count) {
+					if (usable_index == context->usable_count) {
 						goto out_1;
 					}
 
-					size_t index = context->permutation[coefficient_index];
+					size_t j = usable_index;
 
-					++coefficient_index;
+					++usable_index;
 
-					if ((context->usable[index / 8] >> index % 8 & 1) == 1) {
-						keep = false;
+					keep = false;
 
-						if ((context->payload[index / 8] >> index % 8 & 1) != bit) {
-							context->changes[index / 8] |= 1 << index % 8;
+					if ((permuted_payload[j / 8] >> j % 8 & 1) != bit) {
+						size_t index = permuted_indexes[j];
 
-							keep = context->one[index / 8] >> index % 8 & 1;
-						}
+						context->changes[index / 8] |= 1 << index % 8;
+
+						keep = permuted_one[j / 8] >> j % 8 & 1;
 					}
 				}
 			}
@@ -420,67 +1563,90 @@ size_t Cover_Eph5_embed(struct Cover_Eph5 *context, size_t length, const uint8_t
 				l += data_index == length ? 7 + k : 8;
 			}
 
-			int bits = byte & n;
+			int target = byte & n;
 
-			int block_length = 0;
-			size_t indexes[(1 << COVER_EPH5_MAXIMUM_K) - 1];
-			bool payload_bits[(1 << COVER_EPH5_MAXIMUM_K) - 1];
+			if (context->usable_count - usable_index < n) {
+				goto out_high;
+			}
 
-			while (true) {
-				for (; block_length < n; ++block_length) {
-					size_t index;
+			// Each of the remaining groups takes at least n usable coefficients
 
-					while (true) {
-						if (coefficient_index == context->image->coefficients_count) {
-							goto out_high;
-						}
+			if (whole && (context->usable_count - usable_index) / n < ((length - embedded_length) * 8 - e + k - 1) / k) {
+				goto out_high;
+			}
 
-						index = context->permutation[coefficient_index];
-						++coefficient_index;
+			// Bit `q` of the group is the payload bit of its member `q`
 
-						if ((context->usable[index / 8] >> index % 8 & 1) == 1) {
-							break;
-						}
-					}
+			uint_fast64_t group[2] = {load_bits(permuted_payload, usable_index), 0};
+
+			if (n < 64) {
+				group[0] &= ((uint_fast64_t) 1 << n) - 1;
+			} else {
+				group[1] = load_bits(permuted_payload, usable_index + 64) & ((uint_fast64_t) 1 << (n - 64)) - 1;
+			}
 
-					indexes[block_length] = index;
-					payload_bits[block_length] = context->payload[index / 8] >> index % 8 & 1;
+			size_t end = usable_index + n;
 
-					if (payload_bits[block_length]) {
-						bits ^= block_length + 1;
-					}
-				}
+			size_t removed_indexes[REMOVED_INDEXES_CAPACITY];
+			int removed_count = 0;
+
+			size_t members[(1 << COVER_EPH5_MAXIMUM_K) - 1];
+			bool materialized = false;
+
+			while (true) {
+				int bits = target ^ group_syndrome(group);
 
 				if (bits == 0) {
 					break;
 				}
 
-				size_t index = indexes[bits - 1];
+				int q = bits - 1;
+				size_t j = materialized ? members[q] : member_index(usable_index, removed_indexes, removed_count, q);
+				size_t index = permuted_indexes[j];
 
 				context->changes[index / 8] |= 1 << index % 8;
 
-				if ((context->one[index / 8] >> index % 8 & 1) == 1) {
-					int i = bits;
+				if ((permuted_one[j / 8] >> j % 8 & 1) == 0) {
+					break;
+				}
 
-					if (payload_bits[bits - 1]) {
-						bits = 0;
-					}
+				// Shrinkage, the coefficient leaves the group and the next usable one joins it
 
-					for (; i < block_length; ++i) {
-						if (payload_bits[i]) {
-							bits ^= i ^ i + 1;
-						}
+				if (end == context->usable_count) {
+					goto out_high;
+				}
 
-						indexes[i - 1] = indexes[i];
-						payload_bits[i - 1] = payload_bits[i];
+				if (!materialized && removed_count == REMOVED_INDEXES_CAPACITY) {
+					for (int i = 0; i < n; ++i) {
+						members[i] = member_index(usable_index, removed_indexes, removed_count, i);
 					}
 
-					--block_length;
+					materialized = true;
+				}
+
+				if (materialized) {
+					memmove(&members[q], &members[q + 1], (n - 1 - q) * sizeof *members);
+					members[n - 1] = end;
 				} else {
-					break;
+					int i = removed_count;
+
+					for (; i > 0 && removed_indexes[i - 1] > j; --i) {
+						removed_indexes[i] = removed_indexes[i - 1];
+					}
+
+					removed_indexes[i] = j;
+					++removed_count;
 				}
+
+				remove_group_bit(group, q);
+
+				group[(n - 1) / 64] |= (uint_fast64_t) (permuted_payload[end / 8] >> end % 8 & 1) << (n - 1) % 64;
+
+				++end;
 			}
 
+			usable_index = end;
+
 			byte >>= k;
 			l -= k;
 			e += k;
@@ -496,3 +1662,27 @@ size_t Cover_Eph5_embed(struct Cover_Eph5 *context, size_t length, const uint8_t
 
 	return embedded_length;
 }
+
+size_t Cover_Eph5_embed(struct Cover_Eph5 *context, size_t length, const uint8_t *data, int k) {
+	return embed(context, length, data, k, false);
+}
+
+int Cover_Eph5_embed_fit(struct Cover_Eph5 *context, size_t length, const uint8_t *data, int k, size_t *embedded_length) {
+	for (; k > 1; --k) {
+		// The embedding can't fit, and it would walk all usable coefficients to find out
+
+		if (context->maximum_capacity[k - 1] < length) {
+			continue;
+		}
+
+		if (embed(context, length, data, k, true) == length) {
+			*embedded_length = length;
+
+			return k;
+		}
+	}
+
+	*embedded_length = Cover_Eph5_embed(context, length, data, 1);
+
+	return 1;
+}
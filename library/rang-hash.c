@@ -11,7 +11,7 @@ void Cover_Rang_hash(
 	uint8_t *hash,
 	const struct salsa20_ctx *context,
 	uint_fast32_t start,
-	uint_fast32_t count,
+	size_t count,
 	const uint8_t *bits
 ) {
 	for (size_t i = 0; i < count; ++i) {
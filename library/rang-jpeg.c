@@ -10,82 +10,129 @@
 #include <jpeglib.h>
 #include <nettle/salsa20.h>
 
-static void decode_coefficients(struct Cover_Rang *context) {
-	struct jpeg_decompress_struct *decompressor = context->clear->decompressor;
-	struct jvirt_barray_control *coefficients = context->clear->coefficients;
+#include "bits.h"
+#include "vectors.h"
+#include "workspace.h"
+
+// Bit `c` of each mask corresponds to the coefficient `c` of the block
+
+static void scan_block(
+	const JCOEF *block,
+	const JCOEF *modified_block,
+	uint_fast64_t *odd,
+	uint_fast64_t *different,
+	uint_fast64_t *increased
+) {
+	*odd = 0;
+	*different = 0;
+	*increased = 0;
 
-	bool compare = context->modified != NULL;
+	#ifdef VECTOR_LENGTH
+		for (size_t c = 0; c < COVER_CONTAINER_BLOCK_LENGTH; c += 2 * VECTOR_LENGTH) {
+			vector low = vector_load(block + c);
+			vector high = vector_load(block + c + VECTOR_LENGTH);
 
-	struct jpeg_decompress_struct *modified_decompressor;
-	struct jvirt_barray_control *modified_coefficients;
+			*odd |= vector_signs(vector_lsb(low), vector_lsb(high)) << c;
+
+			if (modified_block != NULL) {
+				vector modified_low = vector_load(modified_block + c);
+				vector modified_high = vector_load(modified_block + c + VECTOR_LENGTH);
+
+				*different |= vector_signs(vector_equal(low, modified_low), vector_equal(high, modified_high)) << c;
+				*increased |= vector_signs(vector_greater(modified_low, low), vector_greater(modified_high, high)) << c;
+			}
+		}
+
+		*different = ~*different;
+	#else
+		for (size_t c = 0; c < COVER_CONTAINER_BLOCK_LENGTH; ++c) {
+			JCOEF coefficient = block[c];
+
+			*odd |= (uint_fast64_t) (coefficient % 2 != 0) << c;
+
+			if (modified_block != NULL) {
+				*different |= (uint_fast64_t) (modified_block[c] != coefficient) << c;
+				*increased |= (uint_fast64_t) (modified_block[c] > coefficient) << c;
+			}
+		}
+	#endif
 
-	if (compare) {
-		modified_decompressor = context->modified->decompressor;
-		modified_coefficients = context->modified->coefficients;
+	if (modified_block == NULL) {
+		*different = 0;
 	}
+}
 
-	size_t width_in_blocks = context->clear->width_in_blocks;
-	size_t height_in_blocks = context->clear->height_in_blocks;
+static void decode_row(void *argument, size_t y, JBLOCKROW row) {
+	struct Cover_Rang *context = argument;
 
-	size_t set_count = 0;
-	size_t usable_count = 0;
+	size_t width_in_blocks = context->clear->width_in_blocks;
 
-	uint8_t *payload = context->payload;
-	uint32_t *usable = context->usable;
-	uint8_t *direction = context->direction;
+	JBLOCKROW modified_row = NULL;
 
-	size_t i = 0;
+	if (context->modified != NULL) {
+		struct jpeg_decompress_struct *modified_decompressor = context->modified->decompressor;
 
-	for (JDIMENSION y = 0; y < height_in_blocks; ++y) {
-		JBLOCKARRAY buffer = decompressor->mem->access_virt_barray(
-			(struct jpeg_common_struct *) decompressor,
-			coefficients, y, 1, false
+		JBLOCKARRAY modified_buffer = modified_decompressor->mem->access_virt_barray(
+			(struct jpeg_common_struct *) modified_decompressor,
+			context->modified->coefficients, y, 1, false
 		);
 
-		JBLOCKARRAY modified_buffer;
+		// Most rows don't differ at all
 
-		if (compare) {
-			modified_buffer = modified_decompressor->mem->access_virt_barray(
-				(struct jpeg_common_struct *) modified_decompressor,
-				modified_coefficients, y, 1, false
-			);
+		if (memcmp(row, modified_buffer[0], sizeof (JBLOCK) * width_in_blocks) != 0) {
+			modified_row = modified_buffer[0];
 		}
+	}
 
-		for (size_t x = 0; x < width_in_blocks; ++x) {
-			for (size_t c = 0; c < COVER_CONTAINER_BLOCK_LENGTH; ++c) {
-				JCOEF coefficient = buffer[0][x][c];
+	size_t set_count = 0;
+	size_t usable_count = context->usable_count;
 
-				bool payload_bit = coefficient % 2 != 0;
+	uint8_t *payload = context->payload;
+	uint32_t *usable = context->usable;
+	uint8_t *direction = context->direction;
 
-				set_count += payload_bit;
+	size_t i = y * width_in_blocks * COVER_CONTAINER_BLOCK_LENGTH;
 
-				payload[i / 8] |= payload_bit << i % 8;
+	for (size_t x = 0; x < width_in_blocks; ++x) {
+		uint_fast64_t odd;
+		uint_fast64_t different;
+		uint_fast64_t increased;
 
-				if (compare) {
-					JCOEF modified_coefficient = modified_buffer[0][x][c];
+		scan_block(row[x], modified_row == NULL ? NULL : modified_row[x], &odd, &different, &increased);
 
-					if (modified_coefficient != coefficient) {
-						usable[usable_count] = i;
+		set_count += count_bits(odd);
 
-						++usable_count;
-					}
+		store_bits(&payload[i / 8], odd);
 
-					direction[i / 8] |= (modified_coefficient > coefficient) << i % 8;
-				}
+		if (different != 0) {
+			store_bits(&direction[i / 8], increased);
 
-				++i;
+			for (; different != 0; different &= different - 1) {
+				usable[usable_count] = i + lowest_bit(different);
+
+				++usable_count;
 			}
 		}
+
+		i += COVER_CONTAINER_BLOCK_LENGTH;
 	}
 
-	context->set_count = set_count;
+	context->set_count += set_count;
 	context->usable_count = usable_count;
 }
 
+static void decode_coefficients(struct Cover_Rang *context) {
+	struct Cover_container_visitor visitor = {decode_row, context};
+
+	Cover_container_visit(context->clear, &visitor, 1);
+}
+
 static const uint8_t strings_seed[SALSA20_256_KEY_SIZE];
 static const uint8_t randomization_nonce[SALSA20_NONCE_SIZE];
 
-bool Cover_Rang_initialize(
+// Allocates arrays, which are then filled by decode_row
+
+static bool allocate(
 	struct Cover_Rang *context,
 	struct Cover_container *clear,
 	struct Cover_container *modified,
@@ -103,7 +150,7 @@ bool Cover_Rang_initialize(
 
 	context->bit_array_length = clear->coefficients_count / 8;
 
-	context->payload = calloc(context->bit_array_length == 0 ? 1 : context->bit_array_length, 1);
+	context->payload = workspace_allocate(&context->workspace, context->bit_array_length, true);
 
 	if (context->payload == NULL) {
 		goto error_payload;
@@ -118,39 +165,121 @@ bool Cover_Rang_initialize(
 			goto error_usable;
 		}
 
-		context->usable = malloc(4 * (clear->coefficients_count == 0 ? 1 : clear->coefficients_count));
+		context->usable = workspace_allocate(&context->workspace, 4 * clear->coefficients_count, false);
 
 		if (context->usable == NULL) {
 			goto error_usable;
 		}
 
-		context->direction = calloc(context->bit_array_length == 0 ? 1 : context->bit_array_length, 1);
+		context->direction = workspace_allocate(&context->workspace, context->bit_array_length, true);
 
 		if (context->direction == NULL) {
 			goto error_direction;
 		}
 
-		context->changes = malloc(context->bit_array_length == 0 ? 1 : context->bit_array_length);
+		context->changes = workspace_allocate(&context->workspace, context->bit_array_length, false);
 
 		if (context->changes == NULL) {
 			goto error_changes;
 		}
 	}
 
-	decode_coefficients(context);
+	context->set_count = 0;
+	context->usable_count = 0;
 
 	return true;
 
-	free(context->changes);
-	error_changes: free(context->direction);
-	error_direction: free(context->usable);
-	error_usable: free(context->payload);
+	error_changes: workspace_free(context->workspace, context->direction);
+	error_direction: workspace_free(context->workspace, context->usable);
+	error_usable: workspace_free(context->workspace, context->payload);
 	error_payload: ;
 
 	return false;
 }
 
+bool Cover_Rang_initialize(
+	struct Cover_Rang *context,
+	struct Cover_container *clear,
+	struct Cover_container *modified,
+	const uint8_t *entropy
+) {
+	context->workspace = NULL;
+
+	if (!allocate(context, clear, modified, entropy)) {
+		return false;
+	}
+
+	decode_coefficients(context);
+
+	return true;
+}
+
+bool Cover_Rang_initialize_deferred(
+	struct Cover_Rang *context,
+	struct Cover_container *clear,
+	struct Cover_container *modified,
+	const uint8_t *entropy,
+	struct Cover_container_visitor *visitor
+) {
+	context->workspace = NULL;
+
+	if (!allocate(context, clear, modified, entropy)) {
+		return false;
+	}
+
+	visitor->visit = decode_row;
+	visitor->argument = context;
+
+	return true;
+}
+
+size_t Cover_Rang_workspace_size(const struct Cover_container *clear, const struct Cover_container *modified) {
+	size_t bit_array_length = clear->coefficients_count / 8;
+	size_t size = 0;
+
+	if (!workspace_add(&size, bit_array_length)) {
+		return 0;
+	}
+
+	// The same arrays as allocated for the same images
+
+	if (modified != NULL) {
+		if (
+			SIZE_MAX / 4 < clear->coefficients_count ||
+			!workspace_add(&size, 4 * clear->coefficients_count) ||
+			!workspace_add(&size, bit_array_length) ||
+			!workspace_add(&size, bit_array_length)
+		) {
+			return 0;
+		}
+	}
+
+	return size;
+}
+
+bool Cover_Rang_initialize_workspace(
+	struct Cover_Rang *context,
+	struct Cover_container *clear,
+	struct Cover_container *modified,
+	const uint8_t *entropy,
+	void *workspace
+) {
+	context->workspace = workspace;
+
+	if (!allocate(context, clear, modified, entropy)) {
+		return false;
+	}
+
+	decode_coefficients(context);
+
+	return true;
+}
+
 void Cover_Rang_destroy(struct Cover_Rang *context) {
+	if (context->workspace != NULL) {
+		return; // All arrays are in the caller's workspace
+	}
+
 	free(context->changes);
 	free(context->direction);
 	free(context->usable);
@@ -177,6 +306,8 @@ size_t Cover_Rang_apply(struct Cover_Rang *context) {
 			coefficients, y, 1, true
 		);
 
+		size_t row_changed_count = changed_count;
+
 		for (size_t x = 0; x < width_in_blocks; ++x) {
 			for (size_t c = 0; c < COVER_CONTAINER_BLOCK_LENGTH; ++c) {
 				if ((changes[i / 8] >> i % 8 & 1) == 1) {
@@ -194,14 +325,22 @@ size_t Cover_Rang_apply(struct Cover_Rang *context) {
 				++i;
 			}
 		}
+
+		if (changed_count != row_changed_count) {
+			Cover_container_mark_changed(context->clear, y);
+		}
 	}
 
 	return changed_count;
 }
 
 void Cover_Rang_extract(struct Cover_Rang *context, size_t length, uint8_t *data) {
+	Cover_Rang_extract_part(context, 0, context->clear->coefficients_count, length, data);
+}
+
+void Cover_Rang_extract_part(struct Cover_Rang *context, size_t start, size_t count, size_t length, uint8_t *data) {
 	memset(data, 0, length);
-	Cover_Rang_hash(length, data, &context->strings_PRNG, 0, context->clear->coefficients_count, context->payload);
+	Cover_Rang_hash(length, data, &context->strings_PRNG, start, count, context->payload);
 }
 
 #define SAMPLE_BUFFER_LENGTH SALSA20_BLOCK_SIZE
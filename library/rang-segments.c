@@ -0,0 +1,136 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <cover/rang.h>
+
+bool Cover_Rang_split(size_t count, const size_t *capacities, size_t length, size_t *lengths) {
+	for (size_t i = 0; i < count; ++i) {
+		if (capacities[i] < COVER_RANG_SEGMENT_HEADER_LENGTH) {
+			return false;
+		}
+
+		lengths[i] = 0;
+	}
+
+	// Fill the images evenly, the embedding time grows as a cube of the segment length
+
+	size_t remaining_length = length;
+
+	while (remaining_length != 0) {
+		size_t open_count = 0;
+
+		for (size_t i = 0; i < count; ++i) {
+			if (lengths[i] < capacities[i] - COVER_RANG_SEGMENT_HEADER_LENGTH) {
+				++open_count;
+			}
+		}
+
+		if (open_count == 0) {
+			return false;
+		}
+
+		size_t share = remaining_length / open_count;
+
+		if (share == 0) {
+			share = 1;
+		}
+
+		for (size_t i = 0; i < count && remaining_length != 0; ++i) {
+			size_t free_length = capacities[i] - COVER_RANG_SEGMENT_HEADER_LENGTH - lengths[i];
+			size_t added_length = share;
+
+			if (added_length > free_length) {
+				added_length = free_length;
+			}
+
+			if (added_length > remaining_length) {
+				added_length = remaining_length;
+			}
+
+			lengths[i] += added_length;
+			remaining_length -= added_length;
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (lengths[i] > COVER_RANG_MAXIMUM_SEGMENT_LENGTH) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// A 16-bit Fletcher checksum of the index, the count and the length. The first sum starts with 1, so a header of zeros is
+// invalid. It rejects images without a segment, which give random headers.
+
+static uint_fast16_t check_header(const uint8_t *header) {
+	uint_fast16_t first_sum = 1;
+	uint_fast16_t second_sum = 0;
+
+	for (size_t i = 0; i < COVER_RANG_SEGMENT_HEADER_LENGTH - 2; ++i) {
+		first_sum = (first_sum + header[i]) % 255;
+		second_sum = (second_sum + first_sum) % 255;
+	}
+
+	return second_sum << 8 | first_sum;
+}
+
+int Cover_Rang_embed_segment(
+	struct Cover_Rang *context,
+	size_t index,
+	size_t count,
+	size_t length,
+	const uint8_t *data,
+	size_t padding_bits_count
+) {
+	uint8_t *segment = malloc(COVER_RANG_SEGMENT_HEADER_LENGTH + length);
+
+	if (segment == NULL) {
+		return 1;
+	}
+
+	uint8_t header[COVER_RANG_SEGMENT_HEADER_LENGTH] = {
+		index >> 8 & 0xff,
+		index & 0xff,
+		count >> 8 & 0xff,
+		count & 0xff,
+		length >> 8 & 0xff,
+		length & 0xff
+	};
+
+	uint_fast16_t check = check_header(header);
+
+	header[6] = check >> 8 & 0xff;
+	header[7] = check & 0xff;
+
+	memcpy(segment, header, COVER_RANG_SEGMENT_HEADER_LENGTH);
+	memcpy(segment + COVER_RANG_SEGMENT_HEADER_LENGTH, data, length);
+
+	int result = Cover_Rang_embed(context, COVER_RANG_SEGMENT_HEADER_LENGTH + length, segment, padding_bits_count);
+
+	free(segment);
+
+	return result;
+}
+
+bool Cover_Rang_extract_segment_header(struct Cover_Rang *context, size_t *index, size_t *count, size_t *length) {
+	uint8_t header[COVER_RANG_SEGMENT_HEADER_LENGTH];
+
+	Cover_Rang_extract(context, COVER_RANG_SEGMENT_HEADER_LENGTH, header);
+
+	*index = (size_t) header[0] << 8 | header[1];
+	*count = (size_t) header[2] << 8 | header[3];
+	*length = (size_t) header[4] << 8 | header[5];
+
+	uint_fast16_t check = (uint_fast16_t) header[6] << 8 | header[7];
+
+	return check == check_header(header) && *index < *count;
+}
+
+void Cover_Rang_extract_segment(struct Cover_Rang *context, size_t length, uint8_t *data) {
+	Cover_Rang_extract(context, COVER_RANG_SEGMENT_HEADER_LENGTH + length, data);
+}
@@ -0,0 +1,89 @@
+#ifndef VECTORS_H
+	#define VECTORS_H
+
+	#include <stdint.h>
+
+	// Vectors of signed 16-bit integers, `VECTOR_LENGTH` is undefined if SIMD is unavailable
+
+	#if defined(__AVX2__)
+		#include <immintrin.h>
+
+		#define VECTOR_LENGTH 16
+
+		typedef __m256i vector;
+
+		static inline vector vector_load(const void *data) {
+			return _mm256_loadu_si256((const __m256i *) data);
+		}
+
+		static inline vector vector_set(int16_t value) {
+			return _mm256_set1_epi16(value);
+		}
+
+		static inline vector vector_or(vector a, vector b) {
+			return _mm256_or_si256(a, b);
+		}
+
+		static inline vector vector_xor(vector a, vector b) {
+			return _mm256_xor_si256(a, b);
+		}
+
+		static inline vector vector_equal(vector a, vector b) {
+			return _mm256_cmpeq_epi16(a, b);
+		}
+
+		static inline vector vector_greater(vector a, vector b) {
+			return _mm256_cmpgt_epi16(a, b);
+		}
+
+		// Moves the least significant bits to the sign bits
+
+		static inline vector vector_lsb(vector a) {
+			return _mm256_slli_epi16(a, 15);
+		}
+
+		// Sign bits of two vectors
+
+		static inline uint_fast64_t vector_signs(vector low, vector high) {
+			return (uint32_t) _mm256_movemask_epi8(_mm256_permute4x64_epi64(_mm256_packs_epi16(low, high), 0xd8));
+		}
+	#elif defined(__SSE2__)
+		#include <emmintrin.h>
+
+		#define VECTOR_LENGTH 8
+
+		typedef __m128i vector;
+
+		static inline vector vector_load(const void *data) {
+			return _mm_loadu_si128((const __m128i *) data);
+		}
+
+		static inline vector vector_set(int16_t value) {
+			return _mm_set1_epi16(value);
+		}
+
+		static inline vector vector_or(vector a, vector b) {
+			return _mm_or_si128(a, b);
+		}
+
+		static inline vector vector_xor(vector a, vector b) {
+			return _mm_xor_si128(a, b);
+		}
+
+		static inline vector vector_equal(vector a, vector b) {
+			return _mm_cmpeq_epi16(a, b);
+		}
+
+		static inline vector vector_greater(vector a, vector b) {
+			return _mm_cmpgt_epi16(a, b);
+		}
+
+		static inline vector vector_lsb(vector a) {
+			return _mm_slli_epi16(a, 15);
+		}
+
+		static inline uint_fast64_t vector_signs(vector low, vector high) {
+			return (uint16_t) _mm_movemask_epi8(_mm_packs_epi16(low, high));
+		}
+	#endif
+#endif
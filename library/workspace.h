@@ -0,0 +1,65 @@
+#ifndef WORKSPACE_H
+	#define WORKSPACE_H
+
+	#include <stddef.h>
+	#include <stdint.h>
+	#include <stdbool.h>
+	#include <string.h>
+	#include <stdlib.h>
+
+	// Arrays are carved from a caller's workspace at this step, so they keep its alignment and don't share cache lines
+
+	#define WORKSPACE_ALIGNMENT 64
+
+	// Adds an array to a workspace size, returns `false` on an overflow
+
+	static inline bool workspace_add(size_t *size, size_t length) {
+		if (length == 0) {
+			length = 1;
+		}
+
+		if (SIZE_MAX - WORKSPACE_ALIGNMENT < length) {
+			return false;
+		}
+
+		length = (length + WORKSPACE_ALIGNMENT - 1) / WORKSPACE_ALIGNMENT * WORKSPACE_ALIGNMENT;
+
+		if (SIZE_MAX - *size < length) {
+			return false;
+		}
+
+		*size += length;
+
+		return true;
+	}
+
+	// Carves an array from a workspace, or allocates it on the heap if there is no workspace
+
+	static inline void *workspace_allocate(uint8_t **workspace, size_t length, bool zeroed) {
+		if (length == 0) {
+			length = 1;
+		}
+
+		if (*workspace == NULL) {
+			return zeroed ? calloc(length, 1) : malloc(length);
+		}
+
+		void *result = *workspace;
+
+		*workspace += (length + WORKSPACE_ALIGNMENT - 1) / WORKSPACE_ALIGNMENT * WORKSPACE_ALIGNMENT;
+
+		if (zeroed) {
+			memset(result, 0, length);
+		}
+
+		return result;
+	}
+
+	// Frees an array on a failure, unless it's carved from a workspace
+
+	static inline void workspace_free(const uint8_t *workspace, void *array) {
+		if (workspace == NULL) {
+			free(array);
+		}
+	}
+#endif
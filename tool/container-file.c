@@ -1,10 +1,19 @@
+#include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 #include <setjmp.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <cover/container.h>
 #include <jpeglib.h>
 
+#include "file.h"
 #include "container-file.h"
 
 static void error_exit(j_common_ptr compressor) {
@@ -27,15 +36,7 @@ static void emit_message(j_common_ptr compressor, int level) {
 	}
 }
 
-bool container_file_initialize(struct container_file *context, const char *name) {
-	FILE *file = fopen(name, "rb");
-
-	if (file == NULL) {
-		perror("LibC error");
-
-		goto error_file;
-	}
-
+static bool read_container(struct container_file *context, FILE *file, size_t length, const uint8_t *data, bool header_only) {
 	jpeg_std_error(&context->error_manager);
 	context->error_manager.error_exit = error_exit;
 	context->error_manager.emit_message = emit_message;
@@ -48,47 +49,172 @@ bool container_file_initialize(struct container_file *context, const char *name)
 	}
 
 	jpeg_create_decompress(&context->decompressor);
-	jpeg_stdio_src(&context->decompressor, file);
 
-	if (!Cover_container_read(&context->container, &context->decompressor)) {
+	bool compatible;
+
+	if (file == NULL && !header_only) {
+		compatible = Cover_container_read_buffer(&context->container, &context->decompressor, length, data);
+	} else {
+		if (file != NULL) {
+			jpeg_stdio_src(&context->decompressor, file);
+		} else {
+			jpeg_mem_src(&context->decompressor, (unsigned char *) data, length);
+		}
+
+		if (header_only) {
+			compatible = Cover_container_read_header(&context->container, &context->decompressor);
+		} else {
+			compatible = Cover_container_read(&context->container, &context->decompressor);
+		}
+	}
+
+	if (!compatible) {
 		fputs("Incompatible image\n", stderr);
 
 		goto error_container;
 	}
 
-	if (fclose(file) == EOF) {
-		perror("LibC error");
+	return true;
+
+	error_container: ;
+	error_decompressor: jpeg_destroy_decompress(&context->decompressor);
+
+	return false;
+}
+
+// Regular files are mapped and passed to LibJPEG as one buffer, instead of being copied through small reads. Pipes
+// can't be mapped, they are read with stdio.
+
+static bool map_file(struct container_file *context, FILE *file) {
+	context->mapping = NULL;
+
+	struct stat status;
+
+	if (
+		fstat(fileno(file), &status) == -1 ||
+		!S_ISREG(status.st_mode) ||
+		status.st_size == 0 ||
+		(uintmax_t) status.st_size > SIZE_MAX
+	) {
+		return false;
+	}
 
-		file = NULL;
+	void *mapping = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
 
-		goto error_close;
+	if (mapping == MAP_FAILED) {
+		return false;
 	}
 
-	file = NULL;
+	madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+
+	context->mapping = mapping;
+	context->mapping_length = status.st_size;
 
 	return true;
+}
 
-	error_close: ;
-	error_container: ;
-	error_decompressor: jpeg_destroy_decompress(&context->decompressor);
+static void unmap_file(struct container_file *context) {
+	if (context->mapping != NULL) {
+		munmap(context->mapping, context->mapping_length);
+	}
+}
+
+static bool read_file(struct container_file *context, FILE *file, bool header_only) {
+	bool result;
+
+	if (map_file(context, file)) {
+		context->original = context->mapping;
+		context->original_length = context->mapping_length;
+
+		result = read_container(context, NULL, context->mapping_length, context->mapping, header_only);
+	} else {
+		context->original = NULL;
+
+		result = read_container(context, file, 0, NULL, header_only);
+	}
+
+	if (!result) {
+		unmap_file(context);
+	}
+
+	return result;
+}
+
+bool container_file_initialize(struct container_file *context, const char *name) {
+	FILE *file = file_open(name, false);
 
-	if (file != NULL && fclose(file) == EOF) {
+	if (file == NULL) {
 		perror("LibC error");
+
+		return false;
 	}
 
-	error_file: ;
+	bool result = read_file(context, file, false);
 
-	return false;
+	context->file = NULL;
+
+	if (file_close(file) == EOF) {
+		perror("LibC error");
+
+		if (result) {
+			container_file_destroy(context);
+		}
+
+		result = false;
+	}
+
+	return result;
+}
+
+bool container_file_initialize_buffer(struct container_file *context, size_t length, const uint8_t *data) {
+	context->file = NULL;
+	context->mapping = NULL;
+	context->original = data;
+	context->original_length = length;
+
+	return read_container(context, NULL, length, data, false);
+}
+
+bool container_file_open(struct container_file *context, const char *name) {
+	context->file = file_open(name, false);
+
+	if (context->file == NULL) {
+		perror("LibC error");
+
+		return false;
+	}
+
+	if (!read_file(context, context->file, true)) {
+		file_close(context->file);
+
+		return false;
+	}
+
+	// A mapping stays valid without the file
+
+	if (context->mapping != NULL) {
+		file_close(context->file);
+
+		context->file = NULL;
+	}
+
+	return true;
 }
 
 void container_file_destroy(struct container_file *context) {
 	jpeg_destroy_decompress(&context->decompressor);
+
+	if (context->file != NULL) {
+		file_close(context->file);
+	}
+
+	unmap_file(context);
 }
 
-bool container_file_write(struct container_file *context, const char *name) {
+bool container_file_write(struct container_file *context, const char *name, bool reuse_tables) {
 	bool result = false;
 
-	FILE *file = fopen(name, "wb");
+	FILE *file = file_open(name, true);
 
 	if (file == NULL) {
 		perror("LibC error");
@@ -108,7 +234,11 @@ bool container_file_write(struct container_file *context, const char *name) {
 	jpeg_create_compress(&compressor);
 	jpeg_stdio_dest(&compressor, file);
 
-	Cover_container_write(&context->container, &compressor);
+	if (reuse_tables) {
+		Cover_container_write_fast(&context->container, &compressor);
+	} else {
+		Cover_container_write(&context->container, &compressor);
+	}
 
 	jpeg_finish_compress(&compressor);
 
@@ -116,7 +246,7 @@ bool container_file_write(struct container_file *context, const char *name) {
 
 	error_compressor: jpeg_destroy_compress(&compressor);
 
-	if (fclose(file) == EOF) {
+	if (file_close(file) == EOF) {
 		perror("LibC error");
 
 		result = false;
@@ -126,3 +256,41 @@ bool container_file_write(struct container_file *context, const char *name) {
 
 	return result;
 }
+
+// Returns 0 on success, 1 if the image can't be spliced or -1 on a LibJPEG error. The buffer is kept by the caller, so that
+// it isn't lost after a `longjmp`.
+
+static int splice_image(struct container_file *context, size_t *length, uint8_t **data) {
+	if (setjmp(context->catch) != 0) {
+		return -1;
+	}
+
+	if (!Cover_container_write_spliced(&context->container, context->original_length, context->original, length, data)) {
+		return 1;
+	}
+
+	return 0;
+}
+
+// Splicing needs the original image, which is kept for mapped files and buffers, but not for files read with stdio
+
+bool container_file_write_spliced(struct container_file *context, const char *name) {
+	if (context->original == NULL) {
+		return container_file_write(context, name, true);
+	}
+
+	size_t length;
+	uint8_t *data = NULL;
+
+	int splicing_result = splice_image(context, &length, &data);
+
+	if (splicing_result == 1) {
+		return container_file_write(context, name, true);
+	}
+
+	bool result = splicing_result == 0 && file_write(name, length, data);
+
+	free(data);
+
+	return result;
+}
@@ -1,6 +1,8 @@
 #ifndef CONTAINER_FILE_H
 	#define CONTAINER_FILE_H
 
+	#include <stddef.h>
+	#include <stdint.h>
 	#include <stdbool.h>
 	#include <setjmp.h>
 	#include <stdio.h>
@@ -15,9 +17,20 @@
 
 		struct jpeg_error_mgr error_manager;
 		struct jpeg_decompress_struct decompressor;
+
+		FILE *file;
+
+		void *mapping;
+		size_t mapping_length;
+
+		const uint8_t *original;
+		size_t original_length;
 	};
 
 	bool container_file_initialize(struct container_file *context, const char *name);
+	bool container_file_initialize_buffer(struct container_file *context, size_t length, const uint8_t *data);
+	bool container_file_open(struct container_file *context, const char *name);
 	void container_file_destroy(struct container_file *context);
-	bool container_file_write(struct container_file *context, const char *name);
+	bool container_file_write(struct container_file *context, const char *name, bool reuse_tables);
+	bool container_file_write_spliced(struct container_file *context, const char *name);
 #endif
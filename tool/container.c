@@ -10,8 +10,11 @@
 #include <cover/container.h>
 
 #include "main.h"
+#include "file.h"
 #include "container-file.h"
 
+#define COEFFICIENTS_BUFFER_LENGTH 4096
+
 static int main_read(int argc, char **argv) {
 	int result = EXIT_FAILURE;
 
@@ -43,7 +46,7 @@ static int main_read(int argc, char **argv) {
 	printf("Height in blocks: %zu\n", container->height_in_blocks);
 	printf("Coefficients: %zu\n", container->coefficients_count);
 
-	FILE *result_file = fopen(argv[optind + 1], "wb");
+	FILE *result_file = file_open(argv[optind + 1], true);
 
 	if (result_file == NULL) {
 		perror("LibC error");
@@ -52,40 +55,41 @@ static int main_read(int argc, char **argv) {
 		goto error_result_file;
 	}
 
+	struct Cover_container_plane plane;
+
 	if (setjmp(image.catch) != 0) {
 		fputs("Can't read coefficients\n", stderr);
 
 		goto error_coefficients;
 	}
 
-	struct jpeg_decompress_struct *decompressor = container->decompressor;
-	struct jvirt_barray_control *coefficients = container->coefficients;
+	if (!Cover_container_export_plane(container, &plane)) {
+		fputs("Can't allocate memory\n", stderr);
+
+		goto error_coefficients;
+	}
+
+	uint8_t bytes[2 * COEFFICIENTS_BUFFER_LENGTH];
 
-	size_t width_in_blocks = container->width_in_blocks;
-	size_t height_in_blocks = container->height_in_blocks;
+	for (size_t i = 0; i < container->coefficients_count; i += COEFFICIENTS_BUFFER_LENGTH) {
+		size_t count = container->coefficients_count - i;
 
-	for (JDIMENSION y = 0; y < height_in_blocks; ++y) {
-		JBLOCKARRAY buffer = decompressor->mem->access_virt_barray(
-			(struct jpeg_common_struct *) decompressor,
-			coefficients, y, 1, false
-		);
+		if (count > COEFFICIENTS_BUFFER_LENGTH) {
+			count = COEFFICIENTS_BUFFER_LENGTH;
+		}
 
-		for (size_t x = 0; x < width_in_blocks; ++x) {
-			for (size_t c = 0; c < COVER_CONTAINER_BLOCK_LENGTH; ++c) {
-				JCOEF coefficient = buffer[0][x][c];
+		for (size_t j = 0; j < count; ++j) {
+			uint_fast16_t coefficient = (uint_fast16_t) plane.coefficients[i + j];
 
-				uint8_t bytes[2] = {
-					(uint_fast16_t) coefficient >> 8 & 0xff,
-					(uint_fast16_t) coefficient & 0xff
-				};
+			bytes[2 * j] = coefficient >> 8 & 0xff;
+			bytes[2 * j + 1] = coefficient & 0xff;
+		}
 
-				if (fwrite(bytes, 2, 1, result_file) != 1) {
-					perror("LibC error");
-					fputs("Can't write result\n", stderr);
+		if (fwrite(bytes, 2, count, result_file) != count) {
+			perror("LibC error");
+			fputs("Can't write result\n", stderr);
 
-					goto error_output;
-				}
-			}
+			goto error_output;
 		}
 	}
 
@@ -93,7 +97,9 @@ static int main_read(int argc, char **argv) {
 
 	error_output: ;
 
-	error_coefficients: if (fclose(result_file) == EOF) {
+	error_coefficients: Cover_container_plane_destroy(&plane);
+
+	if (file_close(result_file) == EOF) {
 		perror("LibC error");
 		fputs("Can't write result\n", stderr);
 
@@ -134,7 +140,7 @@ static int main_replace(int argc, char **argv) {
 
 	struct Cover_container *container = &image.container;
 
-	FILE *coefficients_file = fopen(argv[optind], "rb");
+	FILE *coefficients_file = file_open(argv[optind], false);
 
 	if (coefficients_file == NULL) {
 		perror("LibC error");
@@ -143,52 +149,55 @@ static int main_replace(int argc, char **argv) {
 		goto error_coefficients_file;
 	}
 
+	struct Cover_container_plane plane;
+
 	if (setjmp(image.catch) != 0) {
 		fputs("Can't write coefficients\n", stderr);
 
 		goto error_apply;
 	}
 
-	struct jpeg_decompress_struct *decompressor = container->decompressor;
-	struct jvirt_barray_control *coefficients = container->coefficients;
+	if (!Cover_container_export_plane(container, &plane)) {
+		fputs("Can't allocate memory\n", stderr);
 
-	size_t width_in_blocks = container->width_in_blocks;
-	size_t height_in_blocks = container->height_in_blocks;
+		goto error_apply;
+	}
 
 	size_t changed_count = 0;
 
-	for (JDIMENSION y = 0; y < height_in_blocks; ++y) {
-		JBLOCKARRAY buffer = decompressor->mem->access_virt_barray(
-			(struct jpeg_common_struct *) decompressor,
-			coefficients, y, 1, true
-		);
+	uint8_t bytes[2 * COEFFICIENTS_BUFFER_LENGTH];
 
-		for (size_t x = 0; x < width_in_blocks; ++x) {
-			for (size_t c = 0; c < COVER_CONTAINER_BLOCK_LENGTH; ++c) {
-				uint8_t bytes[2];
+	for (size_t i = 0; i < container->coefficients_count; i += COEFFICIENTS_BUFFER_LENGTH) {
+		size_t count = container->coefficients_count - i;
 
-				if (fread(bytes, 2, 1, coefficients_file) != 1) {
-					perror("LibC error");
-					fputs("Can't read coefficients\n", stderr);
+		if (count > COEFFICIENTS_BUFFER_LENGTH) {
+			count = COEFFICIENTS_BUFFER_LENGTH;
+		}
 
-					goto error_input;
-				}
+		if (fread(bytes, 2, count, coefficients_file) != count) {
+			perror("LibC error");
+			fputs("Can't read coefficients\n", stderr);
 
-				int_fast32_t coefficient = (int_fast32_t) bytes[0] << 8 | bytes[1];
+			goto error_input;
+		}
 
-				if ((coefficient >> 15 & 1) == 1) {
-					coefficient |= -0x10000;
-				}
+		for (size_t j = 0; j < count; ++j) {
+			int_fast32_t coefficient = (int_fast32_t) bytes[2 * j] << 8 | bytes[2 * j + 1];
 
-				if (buffer[0][x][c] != coefficient) {
-					++changed_count;
-				}
+			if ((coefficient >> 15 & 1) == 1) {
+				coefficient |= -0x10000;
+			}
 
-				buffer[0][x][c] = coefficient;
+			if (plane.coefficients[i + j] != coefficient) {
+				++changed_count;
 			}
+
+			plane.coefficients[i + j] = coefficient;
 		}
 	}
 
+	Cover_container_import_plane(container, plane.coefficients);
+
 	printf("Changed coefficients: %zu\n", changed_count);
 
 	if (fgetc(coefficients_file) != EOF) {
@@ -202,7 +211,7 @@ static int main_replace(int argc, char **argv) {
 		goto error_input;
 	}
 
-	if (!container_file_write(&image, argv[optind + 2])) {
+	if (!container_file_write(&image, argv[optind + 2], false)) {
 		fputs("Can't write result\n", stderr);
 
 		goto error_output;
@@ -213,7 +222,9 @@ static int main_replace(int argc, char **argv) {
 	error_output: ;
 	error_input: ;
 
-	error_apply: if (fclose(coefficients_file) == EOF) {
+	error_apply: Cover_container_plane_destroy(&plane);
+
+	if (file_close(coefficients_file) == EOF) {
 		perror("LibC error");
 		fputs("Can't close coefficients file\n", stderr);
 
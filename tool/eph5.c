@@ -8,6 +8,11 @@
 #include <stdio.h>
 
 #include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <cover/container.h>
 #include <cover/eph5.h>
@@ -15,18 +20,302 @@
 #include "main.h"
 #include "file.h"
 #include "container-file.h"
+#include "pool.h"
 
 static const char default_password[] = "desu";
 
+struct permutation_cache {
+	struct Cover_Eph5_permutation permutation;
+
+	void *mapping;
+	size_t mapping_length;
+};
+
+static bool permutation_cache_map(struct permutation_cache *context, const char *name, const uint8_t *key, size_t coefficients_count) {
+	int file = open(name, O_RDONLY);
+
+	if (file == -1) {
+		return false;
+	}
+
+	bool result = false;
+
+	struct stat status;
+
+	if (fstat(file, &status) == -1 || status.st_size < COVER_EPH5_PERMUTATION_HEADER_LENGTH || (uintmax_t) status.st_size > SIZE_MAX) {
+		goto error_size;
+	}
+
+	context->mapping_length = status.st_size;
+	context->mapping = mmap(NULL, context->mapping_length, PROT_READ, MAP_SHARED, file, 0);
+
+	if (context->mapping == MAP_FAILED) {
+		perror("LibC error");
+
+		goto error_mapping;
+	}
+
+	if (!Cover_Eph5_permutation_load(&context->permutation, key, coefficients_count, context->mapping_length, context->mapping)) {
+		fputs("Permutation cache doesn't match, regenerating\n", stderr);
+
+		munmap(context->mapping, context->mapping_length);
+
+		goto error_load;
+	}
+
+	// Contexts read the permutation from start to end
+
+	madvise(context->mapping, context->mapping_length, MADV_SEQUENTIAL);
+
+	result = true;
+
+	error_load: ;
+	error_mapping: ;
+	error_size: close(file);
+
+	return result;
+}
+
+// Generates a permutation right in a new cache file, so that big permutations don't have to fit in memory
+
+static bool permutation_cache_create(struct permutation_cache *context, const char *name, const uint8_t *key, size_t coefficients_count) {
+	size_t permutation_length = Cover_Eph5_permutation_length(coefficients_count);
+
+	if (permutation_length == 0 && coefficients_count != 0 || SIZE_MAX - COVER_EPH5_PERMUTATION_HEADER_LENGTH < permutation_length) {
+		return false;
+	}
+
+	size_t name_length = strlen(name);
+
+	char *temporary_name = malloc(name_length + 8);
+
+	if (temporary_name == NULL) {
+		goto error_name;
+	}
+
+	snprintf(temporary_name, name_length + 8, "%s.XXXXXX", name);
+
+	int file = mkstemp(temporary_name);
+
+	if (file == -1) {
+		goto error_file;
+	}
+
+	context->mapping_length = COVER_EPH5_PERMUTATION_HEADER_LENGTH + permutation_length;
+
+	if (ftruncate(file, context->mapping_length) == -1) {
+		goto error_size;
+	}
+
+	context->mapping = mmap(NULL, context->mapping_length, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+
+	if (context->mapping == MAP_FAILED) {
+		goto error_mapping;
+	}
+
+	uint8_t *mapping = context->mapping;
+
+	Cover_Eph5_permutation_initialize_buffer(&context->permutation, key, coefficients_count, mapping + COVER_EPH5_PERMUTATION_HEADER_LENGTH);
+	Cover_Eph5_permutation_write_header(&context->permutation, mapping);
+
+	// The file gets its name only after it's on the disk, so that a crash doesn't leave a partial cache. The mapping stays
+	// valid after the rename.
+
+	if (msync(mapping, context->mapping_length, MS_SYNC) != 0 || fsync(file) != 0) {
+		goto error_save;
+	}
+
+	if (rename(temporary_name, name) != 0) {
+		goto error_save;
+	}
+
+	close(file);
+	free(temporary_name);
+
+	return true;
+
+	error_save: munmap(context->mapping, context->mapping_length);
+	error_mapping: ;
+	error_size: close(file);
+	unlink(temporary_name);
+	error_file: free(temporary_name);
+	error_name: ;
+
+	perror("LibC error");
+	fputs("Can't save permutation cache\n", stderr);
+
+	context->mapping = NULL;
+
+	return false;
+}
+
+// Loads a permutation from a cache file, or generates it there
+
+static bool permutation_cache_open(struct permutation_cache *context, const char *name, const uint8_t *key, size_t coefficients_count) {
+	context->mapping = NULL;
+
+	if (name != NULL && (
+		permutation_cache_map(context, name, key, coefficients_count) ||
+		permutation_cache_create(context, name, key, coefficients_count)
+	)) {
+		return true;
+	}
+
+	context->mapping = NULL;
+
+	return Cover_Eph5_permutation_initialize(&context->permutation, key, coefficients_count);
+}
+
+static void permutation_cache_close(struct permutation_cache *context) {
+	Cover_Eph5_permutation_destroy(&context->permutation);
+
+	if (context->mapping != NULL) {
+		munmap(context->mapping, context->mapping_length);
+	}
+}
+
+static void print_container(const struct Cover_container *container) {
+	printf("Width in blocks: %zu\n", container->width_in_blocks);
+	printf("Height in blocks: %zu\n", container->height_in_blocks);
+	printf("Coefficients: %zu\n", container->coefficients_count);
+}
+
+static void print_capacities(const struct Cover_Eph5 *Eph5) {
+	printf("Usable coefficients: %zu\n", Eph5->usable_count);
+	printf("One coefficients: %zu\n", Eph5->one_count);
+	printf("Guaranteed capacity in bytes (for different k):\n");
+
+	for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
+		printf("%zu. %zu\n", i + 1, Eph5->guaranteed_capacity[i]);
+	}
+
+	printf("Maximum capacity:\n");
+
+	for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
+		printf("%zu. %zu\n", i + 1, Eph5->maximum_capacity[i]);
+	}
+
+	printf("Expected capacity:\n");
+
+	for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
+		printf("%zu. %zu\n", i + 1, Eph5->expected_capacity[i]);
+	}
+
+}
+
+static int main_analyze(int argc, char **argv) {
+	int result = EXIT_FAILURE;
+
+	opterr = 0;
+
+	if (getopt(argc, argv, "") != -1) {
+		fputs("No command line options supported\n", stderr);
+
+		goto error_command_line;
+	}
+
+	if (argc - optind != 1) {
+		fputs("Wrong number of file arguments\n", stderr);
+
+		goto error_command_line;
+	}
+
+	struct container_file image;
+
+	if (!container_file_open(&image, argv[optind])) {
+		fputs("Can't read image\n", stderr);
+
+		goto error_image;
+	}
+
+	print_container(&image.container);
+
+	if (setjmp(image.catch) != 0) {
+		fputs("Can't read coefficients\n", stderr);
+
+		goto error_coefficients;
+	}
+
+	// The coefficients are only scanned, they aren't kept
+
+	struct Cover_Eph5 Eph5;
+
+	Cover_Eph5_analyze(&Eph5, &image.container);
+
+	print_capacities(&Eph5);
+
+	result = EXIT_SUCCESS;
+
+	error_coefficients: container_file_destroy(&image);
+	error_image: ;
+	error_command_line: ;
+
+	return result;
+}
+
+struct result_files {
+	FILE *files[COVER_EPH5_MAXIMUM_K];
+};
+
+static bool write_result(void *argument, int k, size_t length, const uint8_t *data) {
+	struct result_files *files = argument;
+
+	if (fwrite(data, length, 1, files->files[k - 1]) != 1) {
+		perror("LibC error");
+		fprintf(stderr, "Can't write result for k = %i\n", k);
+
+		return false;
+	}
+
+	return true;
+}
+
+// Streams the results, so no buffers of the extractable lengths are needed
+
+static bool extract_to_files(struct Cover_Eph5 *Eph5, char **names) {
+	bool result = false;
+
+	struct result_files files = {{0}};
+
+	for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
+		files.files[i] = file_open(names[i], true);
+
+		if (files.files[i] == NULL) {
+			perror("LibC error");
+			fprintf(stderr, "Can't open result file for k = %zu\n", i + 1);
+
+			goto error_files;
+		}
+	}
+
+	result = Cover_Eph5_extract_stream(Eph5, write_result, &files);
+
+	error_files: for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
+		if (files.files[i] != NULL && file_close(files.files[i]) == EOF) {
+			perror("LibC error");
+
+			result = false;
+		}
+	}
+
+	return result;
+}
+
 static int main_extract(int argc, char **argv) {
 	int result = EXIT_FAILURE;
 
 	const char *password = default_password;
+	const char *cache_name = NULL;
+	size_t requested_length = SIZE_MAX;
+	int requested_k = 0;
 
-	const char *short_options = "p:";
+	const char *short_options = "p:c:l:k:";
 
 	struct option long_options[] = {
 		{"password", required_argument, NULL, 'p'},
+		{"permutation-cache", required_argument, NULL, 'c'},
+		{"length", required_argument, NULL, 'l'},
+		{"k", required_argument, NULL, 'k'},
 		{0}
 	};
 
@@ -39,6 +328,30 @@ static int main_extract(int argc, char **argv) {
 			break;
 		} else if (option == 'p') {
 			password = optarg;
+		} else if (option == 'c') {
+			cache_name = optarg;
+		} else if (option == 'l') {
+			char *end;
+			uintmax_t parsed = strtoumax(optarg, &end, 0);
+
+			if (*optarg == '\0' || *end != '\0' || parsed > SIZE_MAX) {
+				fputs("Wrong length\n", stderr);
+
+				goto error_command_line;
+			}
+
+			requested_length = parsed;
+		} else if (option == 'k') {
+			char *end;
+			uintmax_t parsed = strtoumax(optarg, &end, 0);
+
+			if (*optarg == '\0' || *end != '\0' || parsed == 0 || parsed > COVER_EPH5_MAXIMUM_K) {
+				fputs("Wrong k value\n", stderr);
+
+				goto error_command_line;
+			}
+
+			requested_k = parsed;
 		} else {
 			fputs("Wrong option\n", stderr);
 
@@ -46,7 +359,9 @@ static int main_extract(int argc, char **argv) {
 		}
 	}
 
-	if (argc - optind != 8) {
+	size_t results_count = requested_k == 0 ? COVER_EPH5_MAXIMUM_K : 1;
+
+	if (argc - optind != 1 + results_count) {
 		fputs("Wrong number of file arguments\n", stderr);
 
 		goto error_command_line;
@@ -54,7 +369,7 @@ static int main_extract(int argc, char **argv) {
 
 	struct container_file image;
 
-	if (!container_file_initialize(&image, argv[optind])) {
+	if (!container_file_open(&image, argv[optind])) {
 		fputs("Can't read image\n", stderr);
 
 		goto error_image;
@@ -62,14 +377,20 @@ static int main_extract(int argc, char **argv) {
 
 	struct Cover_container *container = &image.container;
 
-	printf("Width in blocks: %zu\n", container->width_in_blocks);
-	printf("Height in blocks: %zu\n", container->height_in_blocks);
-	printf("Coefficients: %zu\n", container->coefficients_count);
+	print_container(container);
 
 	uint8_t key[COVER_EPH5_KEY_LENGTH];
 
 	Cover_Eph5_expand_password(key, password);
 
+	struct permutation_cache permutation;
+
+	if (!permutation_cache_open(&permutation, cache_name, key, container->coefficients_count)) {
+		fputs("Can't allocate memory\n", stderr);
+
+		goto error_permutation;
+	}
+
 	if (setjmp(image.catch) != 0) {
 		fputs("Can't read coefficients\n", stderr);
 
@@ -78,71 +399,305 @@ static int main_extract(int argc, char **argv) {
 
 	struct Cover_Eph5 Eph5;
 
-	if (!Cover_Eph5_initialize(&Eph5, container, key, false)) {
+	if (!Cover_Eph5_initialize_streaming(&Eph5, container, &permutation.permutation)) {
 		fputs("Can't allocate memory\n", stderr);
 
 		goto error_Eph5;
 	}
 
-	printf("Usable coefficients: %zu\n", Eph5.usable_count);
-	printf("One coefficients: %zu\n", Eph5.one_count);
-	printf("Guaranteed capacity in bytes (for different k):\n");
+	print_capacities(&Eph5);
+
+	printf("Extractable length:\n");
 
 	for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
-		printf("%zu. %zu\n", i + 1, Eph5.guaranteed_capacity[i]);
+		printf("%zu. %zu\n", i + 1, Eph5.extractable_length[i]);
 	}
 
-	printf("Maximum capacity:\n");
+	uint8_t *data[COVER_EPH5_MAXIMUM_K] = {0};
 
-	for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
-		printf("%zu. %zu\n", i + 1, Eph5.maximum_capacity[i]);
+	if (requested_k == 0 && requested_length == SIZE_MAX) {
+		if (!extract_to_files(&Eph5, &argv[optind + 1])) {
+			goto error_output;
+		}
+	} else {
+		// Only the requested prefixes are extracted, so a header probe stops early
+
+		size_t lengths[COVER_EPH5_MAXIMUM_K] = {0};
+
+		for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
+			if (requested_k == 0 || requested_k == i + 1) {
+				lengths[i] = Eph5.extractable_length[i];
+
+				if (lengths[i] > requested_length) {
+					lengths[i] = requested_length;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
+			data[i] = malloc(lengths[i] == 0 ? 1 : lengths[i]);
+
+			if (data[i] == NULL) {
+				perror("LibC error");
+
+				goto error_data;
+			}
+		}
+
+		Cover_Eph5_extract_bounded(&Eph5, lengths, data);
+
+		for (size_t i = 0, j = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
+			if (requested_k != 0 && requested_k != i + 1) {
+				continue;
+			}
+
+			if (!file_write(argv[optind + 1 + j], lengths[i], data[i])) {
+				fprintf(stderr, "Can't write result for k = %zu\n", i + 1);
+
+				goto error_output;
+			}
+
+			++j;
+		}
 	}
 
-	printf("Expected capacity:\n");
+	result = EXIT_SUCCESS;
 
-	for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
-		printf("%zu. %zu\n", i + 1, Eph5.expected_capacity[i]);
+	error_output: ;
+
+	error_data: for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
+		free(data[i]);
 	}
 
-	printf("Extractable length:\n");
+	error_coefficients: Cover_Eph5_destroy(&Eph5);
+	error_Eph5: permutation_cache_close(&permutation);
+	error_permutation: container_file_destroy(&image);
+	error_image: ;
+	error_command_line: ;
 
-	for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
-		printf("%zu. %zu\n", i + 1, Eph5.extractable_length[i]);
+	return result;
+}
+
+struct password_extraction {
+	const struct Cover_Eph5 *source;
+	const char *result_prefix;
+
+	char **passwords;
+	bool *results;
+};
+
+static void extract_password(void *argument, size_t index) {
+	struct password_extraction *extraction = argument;
+	const struct Cover_Eph5 *source = extraction->source;
+
+	extraction->results[index] = false;
+
+	uint8_t key[COVER_EPH5_KEY_LENGTH];
+
+	Cover_Eph5_expand_password(key, extraction->passwords[index]);
+
+	struct Cover_Eph5_permutation permutation;
+
+	if (!Cover_Eph5_permutation_initialize(&permutation, key, source->image->coefficients_count)) {
+		fputs("Can't allocate memory\n", stderr);
+
+		goto error_permutation;
 	}
 
-	uint8_t *data[COVER_EPH5_MAXIMUM_K] = {0};
+	struct Cover_Eph5 Eph5;
+
+	if (!Cover_Eph5_initialize_shared(&Eph5, source, &permutation)) {
+		fputs("Can't allocate memory\n", stderr);
+
+		goto error_Eph5;
+	}
+
+	size_t name_length = strlen(extraction->result_prefix) + 48;
+	char *name_buffer = malloc(COVER_EPH5_MAXIMUM_K * name_length);
+
+	if (name_buffer == NULL) {
+		perror("LibC error");
+
+		goto error_names;
+	}
+
+	char *names[COVER_EPH5_MAXIMUM_K];
 
 	for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
-		data[i] = malloc(Eph5.extractable_length[i] == 0 ? 1 : Eph5.extractable_length[i]);
+		names[i] = name_buffer + i * name_length;
 
-		if (data[i] == NULL) {
-			perror("LibC error");
+		snprintf(names[i], name_length, "%s%zu.%zu", extraction->result_prefix, index + 1, i + 1);
+	}
 
-			goto error_data;
+	if (!extract_to_files(&Eph5, names)) {
+		fprintf(stderr, "Can't write results for password %zu\n", index + 1);
+
+		goto error_output;
+	}
+
+	extraction->results[index] = true;
+
+	error_output: free(name_buffer);
+	error_names: Cover_Eph5_destroy(&Eph5);
+	error_Eph5: Cover_Eph5_permutation_destroy(&permutation);
+	error_permutation: ;
+}
+
+static int main_extract_passwords(int argc, char **argv) {
+	int result = EXIT_FAILURE;
+
+	size_t threads_count = pool_default_threads_count();
+
+	const char *short_options = "t:";
+
+	struct option long_options[] = {
+		{"threads", required_argument, NULL, 't'},
+		{0}
+	};
+
+	opterr = 0;
+
+	while (true) {
+		int option = getopt_long(argc, argv, short_options, long_options, NULL);
+
+		if (option == -1) {
+			break;
+		} else if (option == 't') {
+			if (!pool_parse_threads_count(&threads_count, optarg)) {
+				goto error_command_line;
+			}
+		} else {
+			fputs("Wrong option\n", stderr);
+
+			goto error_command_line;
 		}
 	}
 
-	Cover_Eph5_extract(&Eph5, data);
+	if (argc - optind != 3) {
+		fputs("Wrong number of file arguments\n", stderr);
+
+		goto error_command_line;
+	}
 
-	for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
-		if (!file_write(argv[optind + 1 + i], Eph5.extractable_length[i], data[i])) {
-			fprintf(stderr, "Can't write result for k = %zu\n", i + 1);
+	FILE *passwords_file = file_open(argv[optind + 1], false);
 
-			goto error_output;
+	if (passwords_file == NULL) {
+		perror("LibC error");
+		fputs("Can't open passwords file\n", stderr);
+
+		goto error_passwords_file;
+	}
+
+	char **passwords = NULL;
+	size_t passwords_count = 0;
+	size_t passwords_capacity = 0;
+
+	while (true) {
+		char *line = NULL;
+		size_t line_capacity = 0;
+
+		ssize_t line_length = getline(&line, &line_capacity, passwords_file);
+
+		if (line_length == -1) {
+			free(line);
+
+			if (ferror(passwords_file)) {
+				perror("LibC error");
+				fputs("Can't read passwords file\n", stderr);
+
+				goto error_passwords;
+			}
+
+			break;
+		}
+
+		while (line_length != 0 && (line[line_length - 1] == '\n' || line[line_length - 1] == '\r')) {
+			line[--line_length] = 0;
+		}
+
+		if (passwords_count == passwords_capacity) {
+			size_t capacity = passwords_capacity == 0 ? 16 : passwords_capacity * 2;
+			char **reallocated = realloc(passwords, capacity * sizeof *passwords);
+
+			if (reallocated == NULL) {
+				perror("LibC error");
+				free(line);
+
+				goto error_passwords;
+			}
+
+			passwords = reallocated;
+			passwords_capacity = capacity;
 		}
+
+		passwords[passwords_count++] = line;
+	}
+
+	bool *results = calloc(passwords_count == 0 ? 1 : passwords_count, sizeof *results);
+
+	if (results == NULL) {
+		perror("LibC error");
+
+		goto error_results;
+	}
+
+	struct container_file image;
+
+	if (!container_file_open(&image, argv[optind])) {
+		fputs("Can't read image\n", stderr);
+
+		goto error_image;
 	}
 
+	struct Cover_container *container = &image.container;
+
+	struct Cover_Eph5 Eph5;
+
+	if (setjmp(image.catch) != 0) {
+		fputs("Can't read coefficients\n", stderr);
+
+		goto error_coefficients;
+	}
+
+	// Decodes the coefficients once for all passwords, without keeping them
+
+	if (!Cover_Eph5_initialize_decoded(&Eph5, container)) {
+		fputs("Can't allocate memory\n", stderr);
+
+		goto error_Eph5;
+	}
+
+	struct password_extraction extraction = {
+		.source = &Eph5,
+		.result_prefix = argv[optind + 2],
+		.passwords = passwords,
+		.results = results
+	};
+
+	pool_run(threads_count, passwords_count, extract_password, &extraction);
+
 	result = EXIT_SUCCESS;
 
-	error_output: ;
+	for (size_t i = 0; i < passwords_count; ++i) {
+		if (!results[i]) {
+			fprintf(stderr, "Extraction failed for password %zu\n", i + 1);
 
-	error_data: for (size_t i = 0; i < COVER_EPH5_MAXIMUM_K; ++i) {
-		free(data[i]);
+			result = EXIT_FAILURE;
+		}
 	}
 
 	error_coefficients: Cover_Eph5_destroy(&Eph5);
 	error_Eph5: container_file_destroy(&image);
-	error_image: ;
+	error_image: free(results);
+	error_results: ;
+
+	error_passwords: for (size_t i = 0; i < passwords_count; ++i) {
+		free(passwords[i]);
+	}
+
+	free(passwords);
+	file_close(passwords_file);
+	error_passwords_file: ;
 	error_command_line: ;
 
 	return result;
@@ -155,14 +710,20 @@ static int main_embed(int argc, char **argv) {
 	bool analyze = false;
 	bool fit = false;
 	const char *password = default_password;
+	const char *cache_name = NULL;
+	bool reuse_tables = false;
+	bool splice = false;
 
-	const char *short_options = "k:afp:";
+	const char *short_options = "k:afp:c:rs";
 
 	struct option long_options[] = {
 		{"k", required_argument, NULL, 'k'},
 		{"analyze", no_argument, NULL, 'a'},
 		{"fit", no_argument, NULL, 'f'},
 		{"password", required_argument, NULL, 'p'},
+		{"permutation-cache", required_argument, NULL, 'c'},
+		{"reuse-tables", no_argument, NULL, 'r'},
+		{"splice", no_argument, NULL, 's'},
 		{0}
 	};
 
@@ -191,6 +752,12 @@ static int main_embed(int argc, char **argv) {
 			fit = true;
 		} else if (option == 'p') {
 			password = optarg;
+		} else if (option == 'c') {
+			cache_name = optarg;
+		} else if (option == 'r') {
+			reuse_tables = true;
+		} else if (option == 's') {
+			splice = true;
 		} else {
 			fputs("Wrong option\n", stderr);
 
@@ -218,6 +785,14 @@ static int main_embed(int argc, char **argv) {
 
 	Cover_Eph5_expand_password(key, password);
 
+	struct permutation_cache permutation;
+
+	if (!permutation_cache_open(&permutation, cache_name, key, container->coefficients_count)) {
+		fputs("Can't allocate memory\n", stderr);
+
+		goto error_permutation;
+	}
+
 	if (setjmp(image.catch) != 0) {
 		fputs("Can't read coefficients\n", stderr);
 
@@ -226,7 +801,7 @@ static int main_embed(int argc, char **argv) {
 
 	struct Cover_Eph5 Eph5;
 
-	if (!Cover_Eph5_initialize(&Eph5, container, key, true)) {
+	if (!Cover_Eph5_initialize_with_permutation(&Eph5, container, &permutation.permutation, true)) {
 		fputs("Can't allocate memory\n", stderr);
 
 		goto error_Eph5;
@@ -257,14 +832,10 @@ static int main_embed(int argc, char **argv) {
 
 	size_t embedded_length;
 
-	while (true) {
+	if (fit) {
+		k = Cover_Eph5_embed_fit(&Eph5, length, data, k, &embedded_length);
+	} else {
 		embedded_length = Cover_Eph5_embed(&Eph5, length, data, k);
-
-		if (embedded_length < length && fit && k > 1) {
-			--k;
-		} else {
-			break;
-		}
 	}
 
 	if (analyze || fit) {
@@ -283,13 +854,25 @@ static int main_embed(int argc, char **argv) {
 		goto error_apply;
 	}
 
+	if (splice) {
+		Cover_container_track_changes(container);
+	}
+
 	size_t zeroed_count;
 	size_t changed_count = Cover_Eph5_apply(&Eph5, &zeroed_count);
 
 	printf("Changed coefficients: %zu\n", changed_count);
 	printf("Including zeroed: %zu\n", zeroed_count);
 
-	if (!container_file_write(&image, argv[optind + 2])) {
+	bool written;
+
+	if (splice) {
+		written = container_file_write_spliced(&image, argv[optind + 2]);
+	} else {
+		written = container_file_write(&image, argv[optind + 2], reuse_tables);
+	}
+
+	if (!written) {
 		fputs("Can't write result\n", stderr);
 
 		goto error_output;
@@ -303,7 +886,8 @@ static int main_embed(int argc, char **argv) {
 	error_input: free(data);
 	error_data: ;
 	error_coefficients: Cover_Eph5_destroy(&Eph5);
-	error_Eph5: container_file_destroy(&image);
+	error_Eph5: permutation_cache_close(&permutation);
+	error_permutation: container_file_destroy(&image);
 	error_image: ;
 	error_command_line: ;
 
@@ -321,6 +905,10 @@ int main_eph5(int argc, char **argv) {
 		return main_extract(argc - 1, argv + 1);
 	} else if (strcmp(argv[1], "embed") == 0) {
 		return main_embed(argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "analyze") == 0) {
+		return main_analyze(argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "extract-passwords") == 0) {
+		return main_extract_passwords(argc - 1, argv + 1);
 	} else {
 		fputs("Unknown command\n", stderr);
 
@@ -1,12 +1,90 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <stdio.h>
+#include <errno.h>
+
+#include <unistd.h>
 
 #include "file.h"
 
+static FILE *standard_output = NULL;
+static bool standard_input_opened = false;
+static bool standard_output_opened = false;
+
+bool file_reserve_standard_output(void) {
+	int descriptor = dup(STDOUT_FILENO);
+
+	if (descriptor == -1) {
+		goto error_descriptor;
+	}
+
+	standard_output = fdopen(descriptor, "wb");
+
+	if (standard_output == NULL) {
+		close(descriptor);
+
+		goto error_descriptor;
+	}
+
+	// Reports go to the standard error, so that they don't mix with the data
+
+	if (dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+		fclose(standard_output);
+
+		standard_output = NULL;
+
+		goto error_descriptor;
+	}
+
+	return true;
+
+	error_descriptor: perror("LibC error");
+
+	return false;
+}
+
+FILE *file_open(const char *name, bool write) {
+	if (strcmp(name, "-") == 0) {
+		// A stream can't be rewound, so it's shared by one file argument only
+
+		bool *opened = write ? &standard_output_opened : &standard_input_opened;
+
+		if (*opened) {
+			fputs(write ? "Standard output is already used by another file argument\n" : "Standard input is already used by another file argument\n", stderr);
+
+			errno = EBUSY;
+
+			return NULL;
+		}
+
+		*opened = true;
+
+		if (write) {
+			return standard_output != NULL ? standard_output : stdout;
+		}
+
+		return stdin;
+	}
+
+	return fopen(name, write ? "wb" : "rb");
+}
+
+int file_close(FILE *file) {
+	if (file == stdin) {
+		return 0;
+	}
+
+	if (file == standard_output || file == stdout) {
+		return fflush(file);
+	}
+
+	return fclose(file);
+}
+
 bool file_read(size_t *length, uint8_t *data, const char *name, bool whole) {
-	FILE *file = fopen(name, "rb");
+	FILE *file = file_open(name, false);
 
 	if (file == NULL) {
 		perror("LibC error");
@@ -34,7 +112,7 @@ bool file_read(size_t *length, uint8_t *data, const char *name, bool whole) {
 		}
 	}
 
-	if (fclose(file) == EOF) {
+	if (file_close(file) == EOF) {
 		perror("LibC error");
 
 		result = false;
@@ -44,7 +122,7 @@ bool file_read(size_t *length, uint8_t *data, const char *name, bool whole) {
 }
 
 bool file_write(const char *name, size_t length, const uint8_t *data) {
-	FILE *file = fopen(name, "wb");
+	FILE *file = file_open(name, true);
 
 	if (file == NULL) {
 		perror("LibC error");
@@ -54,13 +132,13 @@ bool file_write(const char *name, size_t length, const uint8_t *data) {
 
 	bool result = true;
 
-	if (fwrite(data, length, 1, file) != 1) {
+	if (length != 0 && fwrite(data, length, 1, file) != 1) {
 		perror("LibC error");
 
 		result = false;
 	}
 
-	if (fclose(file) == EOF) {
+	if (file_close(file) == EOF) {
 		perror("LibC error");
 
 		result = false;
@@ -4,7 +4,11 @@
 	#include <stddef.h>
 	#include <stdint.h>
 	#include <stdbool.h>
+	#include <stdio.h>
 
+	bool file_reserve_standard_output(void);
+	FILE *file_open(const char *name, bool write);
+	int file_close(FILE *file);
 	bool file_read(size_t *length, uint8_t *data, const char *name, bool whole);
 	bool file_write(const char *name, size_t length, const uint8_t *data);
 #endif
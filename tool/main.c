@@ -3,6 +3,7 @@
 #include <stdio.h>
 
 #include "main.h"
+#include "file.h"
 
 int main(int argc, char **argv) {
 	if (argc < 2) {
@@ -11,6 +12,18 @@ int main(int argc, char **argv) {
 		return EXIT_FAILURE;
 	}
 
+	// Data can be written to the standard output, reports are moved away from it
+
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "-") == 0) {
+			if (!file_reserve_standard_output()) {
+				return EXIT_FAILURE;
+			}
+
+			break;
+		}
+	}
+
 	if (strcmp(argv[1], "container") == 0) {
 		return main_container(argc - 1, argv + 1);
 	} else if (strcmp(argv[1], "eph5") == 0) {
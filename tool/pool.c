@@ -0,0 +1,105 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+#define MAXIMUM_THREADS_COUNT 256
+
+size_t pool_default_threads_count(void) {
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (count < 1) {
+		return 1;
+	}
+
+	if (count > MAXIMUM_THREADS_COUNT) {
+		return MAXIMUM_THREADS_COUNT;
+	}
+
+	return count;
+}
+
+bool pool_parse_threads_count(size_t *threads_count, const char *argument) {
+	char *end;
+	uintmax_t parsed = strtoumax(argument, &end, 0);
+
+	if (*argument == '\0' || *end != '\0' || parsed == 0 || parsed > MAXIMUM_THREADS_COUNT) {
+		fputs("Wrong threads count\n", stderr);
+
+		return false;
+	}
+
+	*threads_count = parsed;
+
+	return true;
+}
+
+struct pool {
+	pthread_mutex_t mutex;
+
+	size_t next_index;
+	size_t jobs_count;
+
+	void (*job)(void *argument, size_t index);
+	void *argument;
+};
+
+static void *work(void *argument) {
+	struct pool *context = argument;
+
+	while (true) {
+		pthread_mutex_lock(&context->mutex);
+
+		size_t index = context->next_index;
+
+		if (index < context->jobs_count) {
+			++context->next_index;
+		}
+
+		pthread_mutex_unlock(&context->mutex);
+
+		if (index == context->jobs_count) {
+			break;
+		}
+
+		context->job(context->argument, index);
+	}
+
+	return NULL;
+}
+
+void pool_run(size_t threads_count, size_t jobs_count, void (*job)(void *argument, size_t index), void *argument) {
+	struct pool context = {PTHREAD_MUTEX_INITIALIZER, 0, jobs_count, job, argument};
+
+	if (threads_count > jobs_count) {
+		threads_count = jobs_count;
+	}
+
+	if (threads_count > MAXIMUM_THREADS_COUNT) {
+		threads_count = MAXIMUM_THREADS_COUNT;
+	}
+
+	// The calling thread is a worker too, others are optional
+
+	pthread_t threads[MAXIMUM_THREADS_COUNT];
+	size_t started_count = 0;
+
+	for (; started_count + 1 < threads_count; ++started_count) {
+		if (pthread_create(&threads[started_count], NULL, work, &context) != 0) {
+			break;
+		}
+	}
+
+	work(&context);
+
+	for (size_t i = 0; i < started_count; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+}
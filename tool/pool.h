@@ -0,0 +1,10 @@
+#ifndef POOL_H
+	#define POOL_H
+
+	#include <stddef.h>
+	#include <stdbool.h>
+
+	size_t pool_default_threads_count(void);
+	bool pool_parse_threads_count(size_t *threads_count, const char *argument);
+	void pool_run(size_t threads_count, size_t jobs_count, void (*job)(void *argument, size_t index), void *argument);
+#endif
@@ -8,6 +8,7 @@
 #include <stdio.h>
 
 #include <getopt.h>
+#include <pthread.h>
 
 #include <cover/container.h>
 #include <cover/rang.h>
@@ -19,6 +20,7 @@
 #include "main.h"
 #include "file.h"
 #include "container-file.h"
+#include "pool.h"
 
 static void remove_alpha(size_t length, uint32_t *data) {
 	for (size_t i = 0; i < length; ++i) {
@@ -58,17 +60,17 @@ static void emit_message(j_common_ptr compressor, int level) {
 	}
 }
 
-static bool save_image(size_t width, size_t height, uint32_t *data, const char *file_name, JSAMPLE *row) {
+static bool compress_image(
+	size_t width,
+	size_t height,
+	uint32_t *data,
+	JSAMPLE *row,
+	FILE *file,
+	unsigned char **buffer,
+	unsigned long *buffer_length
+) {
 	bool result = false;
 
-	FILE *file = fopen(file_name, "wb");
-
-	if (file == NULL) {
-		perror("LibC error");
-
-		goto error_file;
-	}
-
 	struct jpeg_error_mgr error_manager;
 
 	jpeg_std_error(&error_manager);
@@ -87,7 +89,12 @@ static bool save_image(size_t width, size_t height, uint32_t *data, const char *
 	}
 
 	jpeg_create_compress(&compressor);
-	jpeg_stdio_dest(&compressor, file);
+
+	if (file != NULL) {
+		jpeg_stdio_dest(&compressor, file);
+	} else {
+		jpeg_mem_dest(&compressor, buffer, buffer_length);
+	}
 
 	compressor.image_width = width;
 	compressor.image_height = height;
@@ -117,41 +124,49 @@ static bool save_image(size_t width, size_t height, uint32_t *data, const char *
 
 	error_compressor: jpeg_destroy_compress(&compressor);
 
-	if (fclose(file) == EOF) {
+	return result;
+}
+
+static bool save_image(size_t width, size_t height, uint32_t *data, const char *file_name, JSAMPLE *row) {
+	FILE *file = file_open(file_name, true);
+
+	if (file == NULL) {
 		perror("LibC error");
 
-		result = false;
+		return false;
 	}
 
-	error_file: ;
+	bool result = compress_image(width, height, data, row, file, NULL, NULL);
+
+	if (file_close(file) == EOF) {
+		perror("LibC error");
+
+		result = false;
+	}
 
 	return result;
 }
 
 #define SYMLINK_NAME_BUFFER_LENGTH (14 + 3 * sizeof (int) + 1)
 
-static int main_modify(int argc, char **argv) {
-	int result = EXIT_FAILURE;
-
-	opterr = 0;
-
-	if (getopt(argc, argv, "") != -1) {
-		fputs("No command line options supported\n", stderr);
-
-		goto error_command_line;
-	}
+struct source_image {
+	FILE *file;
 
-	if (argc - optind != 3) {
-		fputs("Wrong number of file arguments\n", stderr);
+	size_t width;
+	size_t height;
+	uint32_t *data;
 
-		goto error_command_line;
-	}
+	uint32_t *blured_column;
+	uint32_t *untouched_column;
+	JSAMPLE *row;
+};
 
+static bool source_image_load(struct source_image *context, const char *name) {
 	// Imlib2 has problems with file names containing a colon
 
-	FILE *file = fopen(argv[optind], "rb");
+	context->file = file_open(name, false);
 
-	if (file == NULL) {
+	if (context->file == NULL) {
 		perror("LibC error");
 		fputs("Can't open image file\n", stderr);
 
@@ -160,7 +175,7 @@ static int main_modify(int argc, char **argv) {
 
 	char symlink_name[SYMLINK_NAME_BUFFER_LENGTH];
 
-	snprintf(symlink_name, SYMLINK_NAME_BUFFER_LENGTH, "/proc/self/fd/%i", fileno(file));
+	snprintf(symlink_name, SYMLINK_NAME_BUFFER_LENGTH, "/proc/self/fd/%i", fileno(context->file));
 
 	Imlib_Image image = imlib_load_image_immediately_without_cache(symlink_name);
 
@@ -181,25 +196,27 @@ static int main_modify(int argc, char **argv) {
 		goto error_size;
 	}
 
-	uint32_t *data = imlib_image_get_data();
+	context->width = width;
+	context->height = height;
+	context->data = imlib_image_get_data();
 
-	if (data == NULL) {
+	if (context->data == NULL) {
 		fputs("Can't read image\n", stderr);
 
 		goto error_data;
 	}
 
-	uint32_t *blured_column = malloc(4 * (height == 0 ? 1 : height));
+	context->blured_column = malloc(4 * (height == 0 ? 1 : height));
 
-	if (blured_column == NULL) {
+	if (context->blured_column == NULL) {
 		perror("LibC error");
 
 		goto error_blured;
 	}
 
-	uint32_t *untouched_column = malloc(4 * (height == 0 ? 1 : height));
+	context->untouched_column = malloc(4 * (height == 0 ? 1 : height));
 
-	if (untouched_column == NULL) {
+	if (context->untouched_column == NULL) {
 		perror("LibC error");
 
 		goto error_untouched;
@@ -211,27 +228,95 @@ static int main_modify(int argc, char **argv) {
 		goto error_row;
 	}
 
-	JSAMPLE *row = malloc(sizeof (JSAMPLE) * 3 * width);
+	context->row = malloc(sizeof (JSAMPLE) * 3 * width);
 
-	if (row == NULL) {
+	if (context->row == NULL) {
 		perror("LibC error");
 
 		goto error_row;
 	}
 
 	if (imlib_image_has_alpha()) {
-		remove_alpha(width * height, data);
+		remove_alpha(width * height, context->data);
+	}
+
+	return true;
+
+	error_row: free(context->untouched_column);
+	error_untouched: free(context->blured_column);
+	error_blured: imlib_image_put_back_data(context->data);
+	error_data: ;
+	error_size: imlib_free_image();
+
+	error_image: if (file_close(context->file) == EOF) {
+		perror("LibC error");
+		fputs("Can't close image file\n", stderr);
+	}
+
+	error_file: ;
+
+	return false;
+}
+
+static bool source_image_destroy(struct source_image *context) {
+	free(context->row);
+	free(context->untouched_column);
+	free(context->blured_column);
+	imlib_image_put_back_data(context->data);
+	imlib_free_image();
+
+	if (file_close(context->file) == EOF) {
+		perror("LibC error");
+		fputs("Can't close image file\n", stderr);
+
+		return false;
+	}
+
+	return true;
+}
+
+static void source_image_modify(struct source_image *context) {
+	Cover_Rang_modify_image(
+		context->width,
+		context->height,
+		context->data,
+		context->blured_column,
+		context->untouched_column
+	);
+}
+
+static int main_modify(int argc, char **argv) {
+	int result = EXIT_FAILURE;
+
+	opterr = 0;
+
+	if (getopt(argc, argv, "") != -1) {
+		fputs("No command line options supported\n", stderr);
+
+		goto error_command_line;
+	}
+
+	if (argc - optind != 3) {
+		fputs("Wrong number of file arguments\n", stderr);
+
+		goto error_command_line;
+	}
+
+	struct source_image image;
+
+	if (!source_image_load(&image, argv[optind])) {
+		goto error_image;
 	}
 
-	if (!save_image(width, height, data, argv[optind + 1], row)) {
+	if (!save_image(image.width, image.height, image.data, argv[optind + 1], image.row)) {
 		fputs("Can't write clear image\n", stderr);
 
 		goto error_clear;
 	}
 
-	Cover_Rang_modify_image(width, height, data, blured_column, untouched_column);
+	source_image_modify(&image);
 
-	if (!save_image(width, height, data, argv[optind + 2], row)) {
+	if (!save_image(image.width, image.height, image.data, argv[optind + 2], image.row)) {
 		fputs("Can't write modified image\n", stderr);
 
 		goto error_modified;
@@ -240,21 +325,12 @@ static int main_modify(int argc, char **argv) {
 	result = EXIT_SUCCESS;
 
 	error_modified: ;
-	error_clear: free(row);
-	error_row: free(untouched_column);
-	error_untouched: free(blured_column);
-	error_blured: imlib_image_put_back_data(data);
-	error_data: ;
-	error_size: imlib_free_image();
-
-	error_image: if (fclose(file) == EOF) {
-		perror("LibC error");
-		fputs("Can't close image file\n", stderr);
 
+	error_clear: if (!source_image_destroy(&image)) {
 		result = EXIT_FAILURE;
 	}
 
-	error_file: ;
+	error_image: ;
 	error_command_line: ;
 
 	return result;
@@ -361,167 +437,224 @@ static int main_extract(int argc, char **argv) {
 	return result;
 }
 
-static int main_embed(int argc, char **argv) {
-	int result = EXIT_FAILURE;
+static bool parse_size(size_t *value, const char *argument) {
+	char *end;
+	uintmax_t parsed = strtoumax(argument, &end, 0);
 
-	size_t padding_bits_count = COVER_RANG_DEFAULT_PADDING_BITS_COUNT;
-	char *entropy_file_name = NULL;
+	if (*argument == '\0' || *end != '\0' || parsed > SIZE_MAX) {
+		return false;
+	}
 
-	const char *short_options = "e:p:z";
+	*value = parsed;
 
-	struct option long_options[] = {
-		{"entropy", required_argument, NULL, 'e'},
-		{"padding-bits-count", required_argument, NULL, 'p'},
-		{0}
-	};
+	return true;
+}
+
+static int main_hash_shard(int argc, char **argv) {
+	int result = EXIT_FAILURE;
 
 	opterr = 0;
 
-	while (true) {
-		int option = getopt_long(argc, argv, short_options, long_options, NULL);
+	if (getopt(argc, argv, "") != -1) {
+		fputs("No command line options supported\n", stderr);
 
-		if (option == -1) {
-			break;
-		} else if (option == 'e') {
-			entropy_file_name = optarg;
-		} else if (option == 'p') {
-			char *end;
-			uintmax_t parsed = strtoumax(optarg, &end, 0);
+		goto error_command_line;
+	}
 
-			if (*optarg == '\0' || *end != '\0' || parsed > SIZE_MAX) {
-				fputs("Wrong padding bits count\n", stderr);
+	if (argc - optind != 5) {
+		fputs("Wrong number of arguments\n", stderr);
 
-				goto error_command_line;
-			}
+		goto error_command_line;
+	}
 
-			padding_bits_count = parsed;
-		} else {
-			fputs("Wrong option\n", stderr);
+	size_t start;
+	size_t count;
+	size_t data_length;
 
-			goto error_command_line;
-		}
+	if (!parse_size(&start, argv[optind + 1]) || !parse_size(&count, argv[optind + 2])) {
+		fputs("Wrong range\n", stderr);
+
+		goto error_command_line;
 	}
 
-	if (argc - optind != 4) {
-		fputs("Wrong number of file arguments\n", stderr);
+	if (!parse_size(&data_length, argv[optind + 3])) {
+		fputs("Wrong length\n", stderr);
 
 		goto error_command_line;
 	}
 
-	uint8_t entropy[COVER_RANG_ENTROPY_LENGTH];
+	struct container_file image;
 
-	if (entropy_file_name == NULL) {
-		if (gnutls_rnd(GNUTLS_RND_RANDOM, entropy, COVER_RANG_ENTROPY_LENGTH) != 0) {
-			goto error_entropy;
-		}
-	} else {
-		size_t entropy_length = COVER_RANG_ENTROPY_LENGTH;
+	if (!container_file_initialize(&image, argv[optind])) {
+		fputs("Can't read image\n", stderr);
+
+		goto error_image;
+	}
 
-		if (!file_read(&entropy_length, entropy, entropy_file_name, false)) {
-			fputs("Can't read entropy file\n", stderr);
+	struct Cover_container *container = &image.container;
 
-			goto error_entropy;
-		}
+	printf("Width in blocks: %zu\n", container->width_in_blocks);
+	printf("Height in blocks: %zu\n", container->height_in_blocks);
+	printf("Coefficients: %zu\n", container->coefficients_count);
 
-		if (entropy_length != COVER_RANG_ENTROPY_LENGTH) {
-			fputs("Not enough entropy\n", stderr);
+	if (start > container->coefficients_count || container->coefficients_count - start < count) {
+		fputs("Range exceeds the image\n", stderr);
 
-			goto error_entropy;
-		}
+		goto error_range;
 	}
 
-	struct container_file clear;
-	struct container_file modified;
+	if (setjmp(image.catch) != 0) {
+		fputs("Can't read coefficients\n", stderr);
 
-	if (!container_file_initialize(&clear, argv[optind + 1])) {
-		fputs("Can't read clear image\n", stderr);
+		goto error_coefficients;
+	}
 
-		goto error_clear;
+	struct Cover_Rang Rang;
+
+	if (!Cover_Rang_initialize(&Rang, container, NULL, NULL)) {
+		fputs("Can't allocate memory\n", stderr);
+
+		goto error_Rang;
 	}
 
-	if (!container_file_initialize(&modified, argv[optind + 2])) {
-		fputs("Can't read modified image\n", stderr);
+	uint8_t *data = malloc(data_length == 0 ? 1 : data_length);
 
-		goto error_modified;
+	if (data == NULL) {
+		perror("LibC error");
+
+		goto error_data;
 	}
 
-	if (
-		clear.container.width_in_blocks != modified.container.width_in_blocks ||
-		clear.container.height_in_blocks != modified.container.height_in_blocks
-	) {
-		fputs("Images have different dimensions\n", stderr);
+	Cover_Rang_extract_part(&Rang, start, count, data_length, data);
 
-		goto error_size;
+	if (!file_write(argv[optind + 4], data_length, data)) {
+		fputs("Can't write result file\n", stderr);
+
+		goto error_output;
 	}
 
-	if (setjmp(clear.catch) != 0) {
-		fputs("Can't read clear coefficients\n", stderr);
+	result = EXIT_SUCCESS;
 
-		goto error_clear_coefficients;
+	error_output: free(data);
+	error_data: ;
+	error_coefficients: Cover_Rang_destroy(&Rang);
+	error_Rang: ;
+	error_range: container_file_destroy(&image);
+	error_image: ;
+	error_command_line: ;
+
+	return result;
+}
+
+static int main_hash_combine(int argc, char **argv) {
+	int result = EXIT_FAILURE;
+
+	opterr = 0;
+
+	if (getopt(argc, argv, "") != -1) {
+		fputs("No command line options supported\n", stderr);
+
+		goto error_command_line;
 	}
 
-	if (setjmp(modified.catch) != 0) {
-		fputs("Can't read modified coefficients\n", stderr);
+	if (argc - optind < 2) {
+		fputs("Wrong number of file arguments\n", stderr);
 
-		goto error_modified_coefficients;
+		goto error_command_line;
 	}
 
-	struct Cover_Rang Rang;
+	// The first part defines the length and can be a pipe, so it's read until the end into a growing buffer
 
-	if (!Cover_Rang_initialize(&Rang, &clear.container, &modified.container, entropy)) {
-		fputs("Can't allocate memory\n", stderr);
+	FILE *first_part = file_open(argv[optind], false);
 
-		goto error_Rang;
+	if (first_part == NULL) {
+		perror("LibC error");
+		fputs("Can't open part file\n", stderr);
+
+		goto error_first_part;
 	}
 
-	if (Rang.usable_count < padding_bits_count) {
-		fputs("Too low capacity\n", stderr);
+	uint8_t *data = NULL;
+	size_t length = 0;
+	size_t capacity = 0;
+	bool first_part_read = true;
 
-		goto error_capacity;
-	}
+	while (true) {
+		if (length == capacity) {
+			if (capacity > SIZE_MAX / 2) {
+				fputs("Part file too long\n", stderr);
 
-	size_t length = (Rang.usable_count - padding_bits_count) / 8;
+				first_part_read = false;
 
-	printf("Available capacity in bytes: %zu\n", length);
+				break;
+			}
 
-	uint8_t *data = malloc(length == 0 ? 1 : length);
+			size_t new_capacity = capacity == 0 ? 4096 : capacity * 2;
+			uint8_t *reallocated = realloc(data, new_capacity);
 
-	if (data == NULL) {
-		perror("LibC error");
+			if (reallocated == NULL) {
+				perror("LibC error");
 
-		goto error_data;
+				first_part_read = false;
+
+				break;
+			}
+
+			data = reallocated;
+			capacity = new_capacity;
+		}
+
+		size_t read_length = fread(data + length, 1, capacity - length, first_part);
+
+		if (read_length == 0) {
+			break;
+		}
+
+		length += read_length;
 	}
 
-	if (!file_read(&length, data, argv[optind], true)) {
-		fputs("Can't read data\n", stderr);
+	if (ferror(first_part)) {
+		perror("LibC error");
 
-		goto error_input;
+		first_part_read = false;
 	}
 
-	int embedding_result = Cover_Rang_embed(&Rang, length, data, padding_bits_count);
+	if (file_close(first_part) == EOF) {
+		perror("LibC error");
 
-	if (embedding_result != 0) {
-		if (embedding_result == 1) {
-			fputs("Can't allocate memory\n", stderr);
-		} else {
-			fputs("Can't find non-singular matrix\n", stderr);
-		}
+		first_part_read = false;
+	}
 
-		goto error_embed;
+	if (!first_part_read) {
+		fputs("Can't read part file\n", stderr);
+
+		goto error_data;
 	}
 
-	if (setjmp(clear.catch) != 0) {
-		fputs("Can't write coefficients\n", stderr);
+	uint8_t *part = malloc(length == 0 ? 1 : length);
 
-		goto error_apply;
+	if (part == NULL) {
+		perror("LibC error");
+
+		goto error_part;
 	}
 
-	size_t changed_count = Cover_Rang_apply(&Rang);
+	for (int i = optind + 1; i < argc - 1; ++i) {
+		size_t part_length = length;
 
-	printf("Changed coffiecients: %zu\n", changed_count);
+		if (!file_read(&part_length, part, argv[i], true) || part_length != length) {
+			fputs("Can't read part file or parts have different lengths\n", stderr);
 
-	if (!container_file_write(&clear, argv[optind + 3])) {
-		fputs("Can't write result\n", stderr);
+			goto error_input;
+		}
+
+		for (size_t j = 0; j < length; ++j) {
+			data[j] ^= part[j];
+		}
+	}
+
+	if (!file_write(argv[argc - 1], length, data)) {
+		fputs("Can't write result file\n", stderr);
 
 		goto error_output;
 	}
@@ -529,23 +662,876 @@ static int main_embed(int argc, char **argv) {
 	result = EXIT_SUCCESS;
 
 	error_output: ;
-	error_apply: ;
-	error_embed: ;
-	error_input: free(data);
-	error_data: ;
-	error_capacity: ;
+	error_input: free(part);
+	error_part: ;
+	error_data: free(data);
+	error_first_part: ;
+	error_command_line: ;
+
+	return result;
+}
+
+static bool parse_embedding_options(
+	int argc,
+	char **argv,
+	const char **entropy_file_name,
+	size_t *padding_bits_count,
+	size_t *threads_count
+) {
+	const char *short_options = "e:p:t:z";
+
+	struct option long_options[] = {
+		{"entropy", required_argument, NULL, 'e'},
+		{"padding-bits-count", required_argument, NULL, 'p'},
+		{"threads", required_argument, NULL, 't'},
+		{0}
+	};
+
+	opterr = 0;
+
+	while (true) {
+		int option = getopt_long(argc, argv, short_options, long_options, NULL);
+
+		if (option == -1) {
+			break;
+		} else if (option == 'e') {
+			*entropy_file_name = optarg;
+		} else if (option == 'p') {
+			char *end;
+			uintmax_t parsed = strtoumax(optarg, &end, 0);
+
+			if (*optarg == '\0' || *end != '\0' || parsed > SIZE_MAX) {
+				fputs("Wrong padding bits count\n", stderr);
+
+				return false;
+			}
+
+			*padding_bits_count = parsed;
+		} else if (option == 't' && threads_count != NULL) {
+			if (!pool_parse_threads_count(threads_count, optarg)) {
+				return false;
+			}
+		} else {
+			fputs("Wrong option\n", stderr);
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool read_entropy(size_t length, uint8_t *entropy, const char *file_name) {
+	if (file_name == NULL) {
+		return gnutls_rnd(GNUTLS_RND_RANDOM, entropy, length) == 0;
+	}
+
+	size_t entropy_length = length;
+
+	if (!file_read(&entropy_length, entropy, file_name, false)) {
+		fputs("Can't read entropy file\n", stderr);
+
+		return false;
+	}
+
+	if (entropy_length != length) {
+		fputs("Not enough entropy\n", stderr);
+
+		return false;
+	}
+
+	return true;
+}
+
+struct decoding_thread {
+	struct container_file *image;
+
+	const char *name;
+
+	size_t length;
+	const uint8_t *data;
+
+	bool result;
+};
+
+static void *decode_image(void *argument) {
+	struct decoding_thread *context = argument;
+
+	if (context->name != NULL) {
+		context->result = container_file_initialize(context->image, context->name);
+	} else {
+		context->result = container_file_initialize_buffer(context->image, context->length, context->data);
+	}
+
+	return NULL;
+}
+
+// Decodes the modified image in a separate thread
+
+static bool decode_images(struct decoding_thread *clear, struct decoding_thread *modified) {
+	pthread_t modified_thread;
+
+	bool threaded = pthread_create(&modified_thread, NULL, decode_image, modified) == 0;
+
+	if (!threaded) {
+		decode_image(modified);
+	}
+
+	decode_image(clear);
+
+	if (threaded) {
+		pthread_join(modified_thread, NULL);
+	}
+
+	if (!clear->result) {
+		fputs("Can't read clear image\n", stderr);
+
+		if (modified->result) {
+			container_file_destroy(modified->image);
+		}
+
+		return false;
+	}
+
+	if (!modified->result) {
+		fputs("Can't read modified image\n", stderr);
+
+		container_file_destroy(clear->image);
+
+		return false;
+	}
+
+	return true;
+}
+
+static bool embed(
+	struct container_file *clear,
+	struct container_file *modified,
+	const uint8_t *entropy,
+	size_t padding_bits_count,
+	const char *data_file_name,
+	const char *result_file_name
+) {
+	bool result = false;
+
+	if (
+		clear->container.width_in_blocks != modified->container.width_in_blocks ||
+		clear->container.height_in_blocks != modified->container.height_in_blocks
+	) {
+		fputs("Images have different dimensions\n", stderr);
+
+		goto error_size;
+	}
+
+	if (setjmp(clear->catch) != 0) {
+		fputs("Can't read clear coefficients\n", stderr);
+
+		goto error_clear_coefficients;
+	}
+
+	if (setjmp(modified->catch) != 0) {
+		fputs("Can't read modified coefficients\n", stderr);
+
+		goto error_modified_coefficients;
+	}
+
+	struct Cover_Rang Rang;
+
+	if (!Cover_Rang_initialize(&Rang, &clear->container, &modified->container, entropy)) {
+		fputs("Can't allocate memory\n", stderr);
+
+		goto error_Rang;
+	}
+
+	if (Rang.usable_count < padding_bits_count) {
+		fputs("Too low capacity\n", stderr);
+
+		goto error_capacity;
+	}
+
+	size_t length = (Rang.usable_count - padding_bits_count) / 8;
+
+	printf("Available capacity in bytes: %zu\n", length);
+
+	uint8_t *data = malloc(length == 0 ? 1 : length);
+
+	if (data == NULL) {
+		perror("LibC error");
+
+		goto error_data;
+	}
+
+	if (!file_read(&length, data, data_file_name, true)) {
+		fputs("Can't read data\n", stderr);
+
+		goto error_input;
+	}
+
+	int embedding_result = Cover_Rang_embed(&Rang, length, data, padding_bits_count);
+
+	if (embedding_result != 0) {
+		if (embedding_result == 1) {
+			fputs("Can't allocate memory\n", stderr);
+		} else {
+			fputs("Can't find non-singular matrix\n", stderr);
+		}
+
+		goto error_embed;
+	}
+
+	if (setjmp(clear->catch) != 0) {
+		fputs("Can't write coefficients\n", stderr);
+
+		goto error_apply;
+	}
+
+	size_t changed_count = Cover_Rang_apply(&Rang);
+
+	printf("Changed coffiecients: %zu\n", changed_count);
+
+	if (!container_file_write(clear, result_file_name, false)) {
+		fputs("Can't write result\n", stderr);
+
+		goto error_output;
+	}
+
+	result = true;
+
+	error_output: ;
+	error_apply: ;
+	error_embed: ;
+	error_input: free(data);
+	error_data: ;
+	error_capacity: ;
 	error_modified_coefficients: Cover_Rang_destroy(&Rang);
 	error_clear_coefficients: ;
 	error_Rang: ;
-	error_size: container_file_destroy(&modified);
-	error_modified: container_file_destroy(&clear);
-	error_clear: ;
+	error_size: ;
+
+	return result;
+}
+
+static int main_embed(int argc, char **argv) {
+	int result = EXIT_FAILURE;
+
+	size_t padding_bits_count = COVER_RANG_DEFAULT_PADDING_BITS_COUNT;
+	const char *entropy_file_name = NULL;
+
+	if (!parse_embedding_options(argc, argv, &entropy_file_name, &padding_bits_count, NULL)) {
+		goto error_command_line;
+	}
+
+	if (argc - optind != 4) {
+		fputs("Wrong number of file arguments\n", stderr);
+
+		goto error_command_line;
+	}
+
+	uint8_t entropy[COVER_RANG_ENTROPY_LENGTH];
+
+	if (!read_entropy(COVER_RANG_ENTROPY_LENGTH, entropy, entropy_file_name)) {
+		goto error_entropy;
+	}
+
+	struct container_file clear;
+	struct container_file modified;
+
+	struct decoding_thread clear_decoding = {&clear, argv[optind + 1]};
+	struct decoding_thread modified_decoding = {&modified, argv[optind + 2]};
+
+	if (!decode_images(&clear_decoding, &modified_decoding)) {
+		goto error_images;
+	}
+
+	if (embed(&clear, &modified, entropy, padding_bits_count, argv[optind], argv[optind + 3])) {
+		result = EXIT_SUCCESS;
+	}
+
+	container_file_destroy(&modified);
+	container_file_destroy(&clear);
+
+	error_images: ;
+	error_entropy: ;
+	error_command_line: ;
+
+	return result;
+}
+
+static int main_embed_image(int argc, char **argv) {
+	int result = EXIT_FAILURE;
+
+	size_t padding_bits_count = COVER_RANG_DEFAULT_PADDING_BITS_COUNT;
+	const char *entropy_file_name = NULL;
+
+	if (!parse_embedding_options(argc, argv, &entropy_file_name, &padding_bits_count, NULL)) {
+		goto error_command_line;
+	}
+
+	if (argc - optind != 3) {
+		fputs("Wrong number of file arguments\n", stderr);
+
+		goto error_command_line;
+	}
+
+	uint8_t entropy[COVER_RANG_ENTROPY_LENGTH];
+
+	if (!read_entropy(COVER_RANG_ENTROPY_LENGTH, entropy, entropy_file_name)) {
+		goto error_entropy;
+	}
+
+	struct source_image image;
+
+	if (!source_image_load(&image, argv[optind + 1])) {
+		goto error_image;
+	}
+
+	unsigned char *clear_buffer = NULL;
+	unsigned long clear_length = 0;
+
+	unsigned char *modified_buffer = NULL;
+	unsigned long modified_length = 0;
+
+	if (!compress_image(image.width, image.height, image.data, image.row, NULL, &clear_buffer, &clear_length)) {
+		fputs("Can't encode clear image\n", stderr);
+
+		goto error_clear_encoding;
+	}
+
+	source_image_modify(&image);
+
+	if (!compress_image(image.width, image.height, image.data, image.row, NULL, &modified_buffer, &modified_length)) {
+		fputs("Can't encode modified image\n", stderr);
+
+		goto error_modified_encoding;
+	}
+
+	struct container_file clear;
+	struct container_file modified;
+
+	struct decoding_thread clear_decoding = {&clear, NULL, clear_length, clear_buffer};
+	struct decoding_thread modified_decoding = {&modified, NULL, modified_length, modified_buffer};
+
+	if (!decode_images(&clear_decoding, &modified_decoding)) {
+		goto error_images;
+	}
+
+	if (embed(&clear, &modified, entropy, padding_bits_count, argv[optind], argv[optind + 2])) {
+		result = EXIT_SUCCESS;
+	}
+
+	container_file_destroy(&modified);
+	container_file_destroy(&clear);
+
+	error_images: ;
+	error_modified_encoding: free(modified_buffer);
+	error_clear_encoding: free(clear_buffer);
+
+	if (!source_image_destroy(&image)) {
+		result = EXIT_FAILURE;
+	}
+
+	error_image: ;
 	error_entropy: ;
 	error_command_line: ;
 
 	return result;
 }
 
+enum segment_image_stage {
+	SEGMENT_IMAGE_NONE,
+	SEGMENT_IMAGE_CLEAR,
+	SEGMENT_IMAGE_MODIFIED,
+	SEGMENT_IMAGE_RANG
+};
+
+struct segment_image {
+	const char *clear_name;
+	const char *modified_name;
+	const char *result_name;
+
+	enum segment_image_stage stage;
+
+	struct container_file clear;
+	struct container_file modified;
+
+	uint8_t entropy[COVER_RANG_ENTROPY_LENGTH];
+
+	struct Cover_Rang Rang;
+
+	size_t capacity;
+
+	size_t index;
+	size_t count;
+	size_t length;
+	const uint8_t *data;
+	size_t padding_bits_count;
+
+	size_t changed_count;
+	bool result;
+};
+
+static void segment_image_initialize(void *argument, size_t index) {
+	struct segment_image *image = (struct segment_image *) argument + index;
+
+	image->stage = SEGMENT_IMAGE_NONE;
+	image->result = false;
+
+	if (!container_file_initialize(&image->clear, image->clear_name)) {
+		fprintf(stderr, "Can't read clear image %zu\n", index + 1);
+
+		return;
+	}
+
+	image->stage = SEGMENT_IMAGE_CLEAR;
+
+	if (!container_file_initialize(&image->modified, image->modified_name)) {
+		fprintf(stderr, "Can't read modified image %zu\n", index + 1);
+
+		return;
+	}
+
+	image->stage = SEGMENT_IMAGE_MODIFIED;
+
+	if (
+		image->clear.container.width_in_blocks != image->modified.container.width_in_blocks ||
+		image->clear.container.height_in_blocks != image->modified.container.height_in_blocks
+	) {
+		fprintf(stderr, "Images %zu have different dimensions\n", index + 1);
+
+		return;
+	}
+
+	if (setjmp(image->clear.catch) != 0) {
+		fprintf(stderr, "Can't read clear coefficients %zu\n", index + 1);
+
+		image->stage = SEGMENT_IMAGE_RANG;
+
+		return;
+	}
+
+	if (setjmp(image->modified.catch) != 0) {
+		fprintf(stderr, "Can't read modified coefficients %zu\n", index + 1);
+
+		image->stage = SEGMENT_IMAGE_RANG;
+
+		return;
+	}
+
+	if (!Cover_Rang_initialize(&image->Rang, &image->clear.container, &image->modified.container, image->entropy)) {
+		fprintf(stderr, "Can't allocate memory for image %zu\n", index + 1);
+
+		return;
+	}
+
+	image->stage = SEGMENT_IMAGE_RANG;
+
+	image->capacity = 0;
+
+	if (image->Rang.usable_count >= image->padding_bits_count) {
+		image->capacity = (image->Rang.usable_count - image->padding_bits_count) / 8;
+	}
+
+	image->result = true;
+}
+
+static void segment_image_destroy(struct segment_image *image) {
+	if (image->stage >= SEGMENT_IMAGE_RANG) {
+		Cover_Rang_destroy(&image->Rang);
+	}
+
+	if (image->stage >= SEGMENT_IMAGE_MODIFIED) {
+		container_file_destroy(&image->modified);
+	}
+
+	if (image->stage >= SEGMENT_IMAGE_CLEAR) {
+		container_file_destroy(&image->clear);
+	}
+}
+
+static void segment_image_embed(void *argument, size_t index) {
+	struct segment_image *image = (struct segment_image *) argument + index;
+
+	image->result = false;
+
+	int embedding_result = Cover_Rang_embed_segment(
+		&image->Rang,
+		image->index,
+		image->count,
+		image->length,
+		image->data,
+		image->padding_bits_count
+	);
+
+	if (embedding_result != 0) {
+		if (embedding_result == 1) {
+			fprintf(stderr, "Can't allocate memory for image %zu\n", index + 1);
+		} else {
+			fprintf(stderr, "Can't find non-singular matrix for image %zu\n", index + 1);
+		}
+
+		return;
+	}
+
+	if (setjmp(image->clear.catch) != 0) {
+		fprintf(stderr, "Can't write coefficients %zu\n", index + 1);
+
+		return;
+	}
+
+	image->changed_count = Cover_Rang_apply(&image->Rang);
+
+	if (!container_file_write(&image->clear, image->result_name, false)) {
+		fprintf(stderr, "Can't write result %zu\n", index + 1);
+
+		return;
+	}
+
+	image->result = true;
+}
+
+static int main_embed_multiple(int argc, char **argv) {
+	int result = EXIT_FAILURE;
+
+	size_t padding_bits_count = COVER_RANG_DEFAULT_PADDING_BITS_COUNT;
+	const char *entropy_file_name = NULL;
+	size_t threads_count = pool_default_threads_count();
+
+	if (!parse_embedding_options(argc, argv, &entropy_file_name, &padding_bits_count, &threads_count)) {
+		goto error_command_line;
+	}
+
+	if (argc - optind < 4 || (argc - optind - 1) % 3 != 0) {
+		fputs("Wrong number of file arguments\n", stderr);
+
+		goto error_command_line;
+	}
+
+	size_t count = (argc - optind - 1) / 3;
+
+	if (count > COVER_RANG_MAXIMUM_SEGMENTS_COUNT) {
+		fputs("Too many images\n", stderr);
+
+		goto error_command_line;
+	}
+
+	struct segment_image *images = calloc(count, sizeof *images);
+
+	if (images == NULL) {
+		perror("LibC error");
+
+		goto error_images;
+	}
+
+	uint8_t *entropy = malloc(COVER_RANG_ENTROPY_LENGTH * count);
+
+	if (entropy == NULL) {
+		perror("LibC error");
+
+		goto error_entropy_buffer;
+	}
+
+	if (!read_entropy(COVER_RANG_ENTROPY_LENGTH * count, entropy, entropy_file_name)) {
+		goto error_entropy;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		images[i].clear_name = argv[optind + 1 + 3 * i];
+		images[i].modified_name = argv[optind + 2 + 3 * i];
+		images[i].result_name = argv[optind + 3 + 3 * i];
+		images[i].padding_bits_count = padding_bits_count;
+
+		memcpy(images[i].entropy, entropy + COVER_RANG_ENTROPY_LENGTH * i, COVER_RANG_ENTROPY_LENGTH);
+	}
+
+	pool_run(threads_count, count, segment_image_initialize, images);
+
+	size_t *capacities = malloc(sizeof (size_t) * count);
+
+	if (capacities == NULL) {
+		perror("LibC error");
+
+		goto error_capacities;
+	}
+
+	size_t total_capacity = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (!images[i].result) {
+			goto error_initialization;
+		}
+
+		if (images[i].capacity < COVER_RANG_SEGMENT_HEADER_LENGTH) {
+			fprintf(stderr, "Too low capacity of image %zu\n", i + 1);
+
+			goto error_initialization;
+		}
+
+		capacities[i] = images[i].capacity;
+		total_capacity += images[i].capacity - COVER_RANG_SEGMENT_HEADER_LENGTH;
+	}
+
+	printf("Available capacity in bytes: %zu\n", total_capacity);
+
+	size_t length = total_capacity;
+	uint8_t *data = malloc(length == 0 ? 1 : length);
+
+	if (data == NULL) {
+		perror("LibC error");
+
+		goto error_data;
+	}
+
+	if (!file_read(&length, data, argv[optind], true)) {
+		fputs("Can't read data\n", stderr);
+
+		goto error_input;
+	}
+
+	size_t *lengths = malloc(sizeof (size_t) * count);
+
+	if (lengths == NULL) {
+		perror("LibC error");
+
+		goto error_lengths;
+	}
+
+	if (!Cover_Rang_split(count, capacities, length, lengths)) {
+		fputs("Too low capacity\n", stderr);
+
+		goto error_split;
+	}
+
+	size_t offset = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		images[i].index = i;
+		images[i].count = count;
+		images[i].length = lengths[i];
+		images[i].data = data + offset;
+
+		offset += lengths[i];
+	}
+
+	pool_run(threads_count, count, segment_image_embed, images);
+
+	result = EXIT_SUCCESS;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (images[i].result) {
+			printf("Image %zu: embedded bytes: %zu, changed coefficients: %zu\n", i + 1, images[i].length, images[i].changed_count);
+		} else {
+			result = EXIT_FAILURE;
+		}
+	}
+
+	error_split: free(lengths);
+	error_lengths: ;
+	error_input: free(data);
+	error_data: ;
+	error_initialization: free(capacities);
+
+	error_capacities: for (size_t i = 0; i < count; ++i) {
+		segment_image_destroy(&images[i]);
+	}
+
+	error_entropy: free(entropy);
+	error_entropy_buffer: free(images);
+	error_images: ;
+	error_command_line: ;
+
+	return result;
+}
+
+struct extracted_segment {
+	const char *name;
+
+	size_t index;
+	size_t count;
+	size_t length;
+	uint8_t *data;
+
+	bool result;
+};
+
+static void extract_segment(void *argument, size_t index) {
+	struct extracted_segment *segment = (struct extracted_segment *) argument + index;
+
+	segment->data = NULL;
+	segment->result = false;
+
+	struct container_file image;
+
+	if (!container_file_initialize(&image, segment->name)) {
+		fprintf(stderr, "Can't read image %zu\n", index + 1);
+
+		goto error_image;
+	}
+
+	if (setjmp(image.catch) != 0) {
+		fprintf(stderr, "Can't read coefficients %zu\n", index + 1);
+
+		goto error_coefficients;
+	}
+
+	struct Cover_Rang Rang;
+
+	if (!Cover_Rang_initialize(&Rang, &image.container, NULL, NULL)) {
+		fprintf(stderr, "Can't allocate memory for image %zu\n", index + 1);
+
+		goto error_Rang;
+	}
+
+	if (!Cover_Rang_extract_segment_header(&Rang, &segment->index, &segment->count, &segment->length)) {
+		fprintf(stderr, "No segment in image %zu\n", index + 1);
+
+		goto error_header;
+	}
+
+	segment->data = malloc(COVER_RANG_SEGMENT_HEADER_LENGTH + segment->length);
+
+	if (segment->data == NULL) {
+		perror("LibC error");
+
+		goto error_data;
+	}
+
+	Cover_Rang_extract_segment(&Rang, segment->length, segment->data);
+
+	segment->result = true;
+
+	error_data: ;
+	error_header: ;
+	error_coefficients: Cover_Rang_destroy(&Rang);
+	error_Rang: container_file_destroy(&image);
+	error_image: ;
+}
+
+static int main_extract_multiple(int argc, char **argv) {
+	int result = EXIT_FAILURE;
+
+	size_t threads_count = pool_default_threads_count();
+
+	const char *short_options = "t:";
+
+	struct option long_options[] = {
+		{"threads", required_argument, NULL, 't'},
+		{0}
+	};
+
+	opterr = 0;
+
+	while (true) {
+		int option = getopt_long(argc, argv, short_options, long_options, NULL);
+
+		if (option == -1) {
+			break;
+		} else if (option == 't') {
+			if (!pool_parse_threads_count(&threads_count, optarg)) {
+				goto error_command_line;
+			}
+		} else {
+			fputs("Wrong option\n", stderr);
+
+			goto error_command_line;
+		}
+	}
+
+	if (argc - optind < 2) {
+		fputs("Wrong number of file arguments\n", stderr);
+
+		goto error_command_line;
+	}
+
+	size_t count = argc - optind - 1;
+
+	struct extracted_segment *segments = calloc(count, sizeof *segments);
+
+	if (segments == NULL) {
+		perror("LibC error");
+
+		goto error_segments;
+	}
+
+	struct extracted_segment **ordered_segments = calloc(count, sizeof *ordered_segments);
+
+	if (ordered_segments == NULL) {
+		perror("LibC error");
+
+		goto error_ordered_segments;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		segments[i].name = argv[optind + i];
+	}
+
+	pool_run(threads_count, count, extract_segment, segments);
+
+	size_t length = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		if (!segments[i].result) {
+			goto error_extraction;
+		}
+
+		if (segments[i].count != count || ordered_segments[segments[i].index] != NULL) {
+			fputs("Wrong set of images\n", stderr);
+
+			goto error_extraction;
+		}
+
+		ordered_segments[segments[i].index] = &segments[i];
+		length += segments[i].length;
+	}
+
+	FILE *result_file = file_open(argv[argc - 1], true);
+
+	if (result_file == NULL) {
+		perror("LibC error");
+		fputs("Can't open result file\n", stderr);
+
+		goto error_result_file;
+	}
+
+	result = EXIT_SUCCESS;
+
+	for (size_t i = 0; i < count; ++i) {
+		struct extracted_segment *segment = ordered_segments[i];
+
+		if (segment->length != 0 && fwrite(segment->data + COVER_RANG_SEGMENT_HEADER_LENGTH, segment->length, 1, result_file) != 1) {
+			perror("LibC error");
+			fputs("Can't write result\n", stderr);
+
+			result = EXIT_FAILURE;
+
+			break;
+		}
+	}
+
+	if (file_close(result_file) == EOF) {
+		perror("LibC error");
+		fputs("Can't write result\n", stderr);
+
+		result = EXIT_FAILURE;
+	}
+
+	if (result == EXIT_SUCCESS) {
+		printf("Extracted bytes: %zu\n", length);
+	}
+
+	error_result_file: ;
+
+	error_extraction: for (size_t i = 0; i < count; ++i) {
+		free(segments[i].data);
+	}
+
+	free(ordered_segments);
+	error_ordered_segments: free(segments);
+	error_segments: ;
+	error_command_line: ;
+
+	return result;
+}
+
 int main_rang(int argc, char **argv) {
 	if (argc < 2) {
 		fputs("Command not specified\n", stderr);
@@ -559,6 +1545,16 @@ int main_rang(int argc, char **argv) {
 		return main_extract(argc - 1, argv + 1);
 	} else if (strcmp(argv[1], "embed") == 0) {
 		return main_embed(argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "hash-shard") == 0) {
+		return main_hash_shard(argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "hash-combine") == 0) {
+		return main_hash_combine(argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "embed-image") == 0) {
+		return main_embed_image(argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "embed-multiple") == 0) {
+		return main_embed_multiple(argc - 1, argv + 1);
+	} else if (strcmp(argv[1], "extract-multiple") == 0) {
+		return main_extract_multiple(argc - 1, argv + 1);
 	} else {
 		fputs("Unknown command\n", stderr);
 